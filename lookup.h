@@ -0,0 +1,37 @@
+// sensor scaling lookups on the tables of units.h, used by wilo.c and the -bench of
+// tools/units.c: the tables are interpolated between their nodes, the parameters are
+// converted back by searching the node pair around the value
+
+int16_t presLerp(int16_t fine) { // pressure in mbar at pFine
+	uint16_t k;
+
+	if (fine < PRES_TAB_MIN) fine = PRES_TAB_MIN;
+	k = (fine - PRES_TAB_MIN) >> PRES_TAB_SHIFT;
+	if (k >= PRES_TAB_NODES - 1) return presTab[PRES_TAB_NODES - 1];
+	return presTab[k] + ((int32_t) (presTab[k + 1] - presTab[k]) *
+		((fine - PRES_TAB_MIN) & ((1 << PRES_TAB_SHIFT) - 1)) >> PRES_TAB_SHIFT);
+}
+
+int16_t presFine(int16_t mbar) { // pFine at a pressure in mbar
+	uint8_t k;
+
+	for (k = 1; k < PRES_TAB_NODES - 1 && presTab[k] < mbar; k++) ;
+	return PRES_TAB_MIN + ((int16_t) (k - 1) << PRES_TAB_SHIFT) +
+		((int32_t) (mbar - presTab[k - 1]) << PRES_TAB_SHIFT) / (presTab[k] - presTab[k - 1]);
+}
+
+int16_t tempLerp(uint16_t adc) { // heatsink temperature in 0.1C at an A/D value
+	uint16_t k;
+
+	k = adc >> TEMP_TAB_SHIFT;
+	return tempTab[k] + ((int16_t) (tempTab[k + 1] - tempTab[k]) *
+		(int16_t) (adc & ((1 << TEMP_TAB_SHIFT) - 1)) >> TEMP_TAB_SHIFT);
+}
+
+uint16_t tempAdc(int16_t deci) { // A/D value at a heatsink temperature in 0.1C
+	uint8_t k;
+
+	for (k = 1; k < TEMP_TAB_NODES - 1 && tempTab[k] < deci; k++) ;
+	return ((uint16_t) (k - 1) << TEMP_TAB_SHIFT) +
+		((int32_t) (deci - tempTab[k - 1]) << TEMP_TAB_SHIFT) / (tempTab[k] - tempTab[k - 1]);
+}
@@ -0,0 +1,62 @@
+// generated by tools/svpwm.c, do not edit
+
+#define SVPWM_BITS 8 // 256 steps per period
+#define SVPWM_SHIFT 2 // amplitude 508
+
+const int16_t svpwmU[] = {
+	22, 43, 65, 86, 108, 129, 150, 172, 193, 214, 235, 255, 276, 296, 317, 337,
+	357, 376, 396, 415, 434, 444, 450, 456, 461, 466, 471, 475, 480, 484, 487, 491,
+	494, 497, 499, 501, 503, 505, 506, 507, 508, 508, 508, 508, 507, 506, 505, 504,
+	502, 500, 497, 495, 492, 488, 485, 481, 477, 472, 468, 463, 457, 452, 446, 440,
+	446, 452, 457, 463, 468, 472, 477, 481, 485, 488, 492, 495, 497, 500, 502, 504,
+	505, 506, 507, 508, 508, 508, 508, 507, 506, 505, 503, 501, 499, 497, 494, 491,
+	487, 484, 480, 475, 471, 466, 461, 456, 450, 444, 434, 415, 396, 376, 357, 337,
+	317, 296, 276, 255, 235, 214, 193, 172, 150, 129, 108, 86, 65, 43, 22, 0,
+	-22, -43, -65, -86, -108, -129, -150, -172, -193, -214, -235, -255, -276, -296, -317, -337,
+	-357, -376, -396, -415, -434, -444, -450, -456, -461, -466, -471, -475, -480, -484, -487, -491,
+	-494, -497, -499, -501, -503, -505, -506, -507, -508, -508, -508, -508, -507, -506, -505, -504,
+	-502, -500, -497, -495, -492, -488, -485, -481, -477, -472, -468, -463, -457, -452, -446, -440,
+	-446, -452, -457, -463, -468, -472, -477, -481, -485, -488, -492, -495, -497, -500, -502, -504,
+	-505, -506, -507, -508, -508, -508, -508, -507, -506, -505, -503, -501, -499, -497, -494, -491,
+	-487, -484, -480, -475, -471, -466, -461, -456, -450, -444, -434, -415, -396, -376, -357, -337,
+	-317, -296, -276, -255, -235, -214, -193, -172, -150, -129, -108, -86, -65, -43, -22, 0
+};
+
+const int16_t svpwmV[] = {
+	508, 507, 507, 506, 504, 503, 501, 498, 496, 493, 490, 486, 482, 478, 474, 469,
+	464, 459, 454, 448, 442, 427, 408, 389, 370, 350, 330, 310, 290, 269, 249, 228,
+	207, 186, 165, 143, 122, 101, 79, 58, 36, 14, -7, -29, -50, -72, -93, -115,
+	-136, -158, -179, -200, -221, -242, -262, -283, -303, -323, -343, -363, -383, -402, -421, -440,
+	-446, -452, -457, -463, -468, -472, -477, -481, -485, -488, -492, -495, -497, -500, -502, -504,
+	-505, -506, -507, -508, -508, -508, -508, -507, -506, -505, -503, -501, -499, -497, -494, -491,
+	-487, -484, -480, -475, -471, -466, -461, -456, -450, -444, -442, -448, -454, -459, -464, -469,
+	-474, -478, -482, -486, -490, -493, -496, -498, -501, -503, -504, -506, -507, -507, -508, -508,
+	-508, -507, -507, -506, -504, -503, -501, -498, -496, -493, -490, -486, -482, -478, -474, -469,
+	-464, -459, -454, -448, -442, -427, -408, -389, -370, -350, -330, -310, -290, -269, -249, -228,
+	-207, -186, -165, -143, -122, -101, -79, -58, -36, -14, 7, 29, 50, 72, 93, 115,
+	136, 158, 179, 200, 221, 242, 262, 283, 303, 323, 343, 363, 383, 402, 421, 440,
+	446, 452, 457, 463, 468, 472, 477, 481, 485, 488, 492, 495, 497, 500, 502, 504,
+	505, 506, 507, 508, 508, 508, 508, 507, 506, 505, 503, 501, 499, 497, 494, 491,
+	487, 484, 480, 475, 471, 466, 461, 456, 450, 444, 442, 448, 454, 459, 464, 469,
+	474, 478, 482, 486, 490, 493, 496, 498, 501, 503, 504, 506, 507, 507, 508, 508
+};
+
+const int16_t svpwmW[] = {
+	-508, -507, -507, -506, -504, -503, -501, -498, -496, -493, -490, -486, -482, -478, -474, -469,
+	-464, -459, -454, -448, -442, -444, -450, -456, -461, -466, -471, -475, -480, -484, -487, -491,
+	-494, -497, -499, -501, -503, -505, -506, -507, -508, -508, -508, -508, -507, -506, -505, -504,
+	-502, -500, -497, -495, -492, -488, -485, -481, -477, -472, -468, -463, -457, -452, -446, -440,
+	-421, -402, -383, -363, -343, -323, -303, -283, -262, -242, -221, -200, -179, -158, -136, -115,
+	-93, -72, -50, -29, -7, 14, 36, 58, 79, 101, 122, 143, 165, 186, 207, 228,
+	249, 269, 290, 310, 330, 350, 370, 389, 408, 427, 442, 448, 454, 459, 464, 469,
+	474, 478, 482, 486, 490, 493, 496, 498, 501, 503, 504, 506, 507, 507, 508, 508,
+	508, 507, 507, 506, 504, 503, 501, 498, 496, 493, 490, 486, 482, 478, 474, 469,
+	464, 459, 454, 448, 442, 444, 450, 456, 461, 466, 471, 475, 480, 484, 487, 491,
+	494, 497, 499, 501, 503, 505, 506, 507, 508, 508, 508, 508, 507, 506, 505, 504,
+	502, 500, 497, 495, 492, 488, 485, 481, 477, 472, 468, 463, 457, 452, 446, 440,
+	421, 402, 383, 363, 343, 323, 303, 283, 262, 242, 221, 200, 179, 158, 136, 115,
+	93, 72, 50, 29, 7, -14, -36, -58, -79, -101, -122, -143, -165, -186, -207, -228,
+	-249, -269, -290, -310, -330, -350, -370, -389, -408, -427, -442, -448, -454, -459, -464, -469,
+	-474, -478, -482, -486, -490, -493, -496, -498, -501, -503, -504, -506, -507, -507, -508, -508
+};
+
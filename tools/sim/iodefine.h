@@ -0,0 +1,178 @@
+// host replacement for the Renesas iodefine.h (H8/36077)
+//
+// only the registers used by wilo.c are declared; bit fields are declared
+// LSB first to match the byte layout of a little-endian host
+//
+// every register block is reached through an accessor function, so each
+// access costs simulated CPU cycles and gives the plant simulator a chance
+// to advance the timers and run the pending interrupt handlers
+
+#define __interrupt(x)
+
+union un_bits8 {
+	uint8_t BYTE;
+	struct {
+		uint8_t B0:1;
+		uint8_t B1:1;
+		uint8_t B2:1;
+		uint8_t B3:1;
+		uint8_t B4:1;
+		uint8_t B5:1;
+		uint8_t B6:1;
+		uint8_t B7:1;
+	} BIT;
+};
+
+struct st_io {
+	union un_bits8 PDR1, PDR2, PDR3, PDR5, PDR6, PDR7, PDR8, PDRB, PDRC;
+	union un_bits8 PMR1;
+	uint8_t PCR1, PCR2, PCR3, PCR5, PCR6, PCR7, PCR8;
+};
+
+union un_tzsr {
+	uint8_t BYTE;
+	struct {
+		uint8_t IMFA:1;
+		uint8_t IMFB:1;
+		uint8_t IMFC:1;
+		uint8_t IMFD:1;
+		uint8_t OVF:1;
+		uint8_t UDF:1;
+		uint8_t :2;
+	} BIT;
+};
+
+struct st_tz {
+	union un_bits8 TSTR, TMDR, TPMR, TFCR, TOER, TOCR;
+};
+
+struct st_tzn {
+	union un_bits8 TCR, TIORA, TIORC;
+	union un_tzsr TSR;
+	union un_bits8 TIER, POCR;
+	uint16_t TCNT, GRA, GRB, GRC, GRD;
+};
+
+union un_tmb1 {
+	uint8_t BYTE;
+	struct {
+		uint8_t CKS:3;
+		uint8_t :4;
+		uint8_t RLD:1;
+	} BIT;
+};
+
+struct st_tb1 {
+	union un_tmb1 TMB1;
+	union {
+		uint8_t TCB1; // read
+		uint8_t TLB1; // write, also loads the counter
+	} TCB1;
+};
+
+struct st_ad {
+	uint16_t ADDRA, ADDRB, ADDRC, ADDRD;
+	union un_bits8 ADCSR, ADCR;
+};
+
+union un_ssr {
+	uint8_t BYTE;
+	struct {
+		uint8_t MPBT:1;
+		uint8_t MPBR:1;
+		uint8_t TEND:1;
+		uint8_t PER:1;
+		uint8_t FER:1;
+		uint8_t OER:1;
+		uint8_t RDRF:1;
+		uint8_t TDRE:1;
+	} BIT;
+};
+
+struct st_sci3 {
+	union un_bits8 SMR, SCR3;
+	union un_ssr SSR;
+	uint8_t BRR, TDR, RDR;
+};
+
+struct st_wdt {
+	union un_bits8 TCSRWD, TMWD;
+	uint8_t TCWD;
+};
+
+union un_ckcsr {
+	uint8_t BYTE;
+	struct {
+		uint8_t CKSTA:1;
+		uint8_t CKSWIF:1;
+		uint8_t CKSWIE:1;
+		uint8_t OSCSEL:1;
+		uint8_t OSCBAKE:1;
+		uint8_t :1;
+		uint8_t PMRC:2;
+	} BIT;
+};
+
+union un_irr1 {
+	uint8_t BYTE;
+	struct {
+		uint8_t IRRI0:1;
+		uint8_t IRRI1:1;
+		uint8_t IRRI2:1;
+		uint8_t IRRI3:1;
+		uint8_t :3;
+		uint8_t IRRTA:1;
+	} BIT;
+};
+
+union un_ienr2 {
+	uint8_t BYTE;
+	struct {
+		uint8_t :2;
+		uint8_t IENTB1:1;
+		uint8_t :5;
+	} BIT;
+};
+
+union un_irr2 {
+	uint8_t BYTE;
+	struct {
+		uint8_t :2;
+		uint8_t IRRTB1:1;
+		uint8_t :5;
+	} BIT;
+};
+
+struct st_io *simIo(void);
+struct st_tz *simTz(void);
+struct st_tzn *simTz0(void);
+struct st_tzn *simTz1(void);
+struct st_tb1 *simTb1(void);
+struct st_ad *simAd(void);
+struct st_sci3 *simSci3(void);
+struct st_wdt *simWdt(void);
+union un_ckcsr *simCkcsr(void);
+union un_bits8 *simMstcr1(void);
+union un_bits8 *simMstcr2(void);
+union un_bits8 *simIegr1(void);
+union un_bits8 *simIenr1(void);
+union un_irr1 *simIrr1(void);
+union un_ienr2 *simIenr2(void);
+union un_irr2 *simIrr2(void);
+
+#define IO (*simIo())
+#define TZ (*simTz())
+#define TZ0 (*simTz0())
+#define TZ1 (*simTz1())
+#define TB1 (*simTb1())
+#define AD (*simAd())
+#define SCI3 (*simSci3())
+#define WDT (*simWdt())
+#define CKCSR (*simCkcsr())
+#define MSTCR1 (*simMstcr1())
+#define MSTCR2 (*simMstcr2())
+#define IEGR1 (*simIegr1())
+#define IENR1 (*simIenr1())
+#define IRR1 (*simIrr1())
+#define IENR2 (*simIenr2())
+#define IRR2 (*simIrr2())
@@ -0,0 +1,3 @@
+// host replacement for the Renesas machine.h intrinsics
+
+void set_imask_ccr(uint8_t mask);
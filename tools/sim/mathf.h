@@ -0,0 +1,3 @@
+// host replacement for the Renesas mathf.h
+
+#include <math.h>
@@ -0,0 +1,1321 @@
+// closed-loop plant simulator for wilo.c
+//
+// the firmware is compiled for the host together with a register shim
+// (iodefine.h in this directory) and runs unmodified against simulated
+// peripherals, induction motor, centrifugal pump, pressure tank and the
+// frequency output pressure sensor, much faster than real time
+//
+// g++ -O2 -Wall -Wno-unknown-pragmas -Wno-overflow -I tools/sim -o wilosim tools/sim/sim.cpp
+// ./wilosim -t 3600 -s day -l log.csv
+//
+// simulated time advances by a fixed number of CPU cycles on every register
+// access, timer compare matches, sensor edges and A/D conversions are
+// processed in time order and the interrupt handlers are called from the
+// accessors like the real interrupt controller would
+
+#define main wiloMain
+#include "../../wilo.c"
+#undef main
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIM_F_CPU 16000000.0
+#define SIM_ACCESS_CYCLES 16 // average cost of a register access incl. surrounding code
+#define SIM_ISR_CYCLES 40 // exception handling, register save/restore, rte
+#define SIM_ADC_CYCLES 134
+#define SIM_WDT_DIV 8192
+#define SIM_EEP_WRITE_CYCLES 48000 // 3ms
+
+// -c: the firmware code of the interrupt handlers costs time by its host instructions, each
+// weighed like an H8/300H instruction of its kind; the host does a 32-bit operation in one
+// instruction where the H8 may need two, so this estimates the arithmetic, it is no cycle count
+#define SIM_COST_ACCESS_CYCLES 6 // register access, the surrounding code is weighed
+#define SIM_COST_CYCLES 4 // move, add, shift, compare, branch
+#define SIM_COST_MUL_CYCLES 24 // MULXS.W
+#define SIM_COST_DIV_CYCLES 40 // DIVXS.W, longer operands need more
+#define SIM_COST_FLOAT_CYCLES 200 // software floating point
+
+// motor: 1.1kW 2-pole, 230V delta (per phase star equivalent)
+#define MOT_RS 2.5
+#define MOT_RR 2.2
+#define MOT_LLS 0.012
+#define MOT_LLR 0.012
+#define MOT_LM 0.30
+#define MOT_RFE 1500.0 // core loss resistance across the stator EMF, 35W at rated flux
+#define MOT_J 0.002 // kgm2 with the impeller
+#define MOT_POLES 1
+#define MOT_FRICTION 0.05
+
+// pump: p = a * w^2 - b * Q^2, P = Q * p / eta + kd * w^3
+#define PUMP_SHUTOFF 6.2 // bar at 2910rpm
+#define PUMP_QMAX 1.25e-3 // m3/s at 2910rpm and 0 bar
+#define PUMP_ETA 0.55
+#define PUMP_KD 1.25e-5
+#define PUMP_KD_AIR 0.05 // disk friction of a pump that lost its prime, fraction of PUMP_KD
+#define PUMP_SPIKE_TORQUE 3.5 // Nm, debris caught in the impeller
+#define PUMP_SPIKE_TIME 1.0 // s
+#define FLOW_SW_ON 1.5 // l/min
+#define FLOW_SW_OFF 0.8
+
+// pressure vessel and piping
+#define TANK_VOL 0.024 // m3
+#define TANK_PRECHARGE 2.2 // bar
+#define PIPE_COMPLIANCE 2e-4 // m3/bar
+
+// DC bus
+#define BUS_CAP 680e-6
+#define BUS_R_INRUSH 30.0
+#define BUS_R_RELAY 0.5
+#define BUS_AUX_LOAD 5.0 // W
+
+// heatsink
+#define HS_RTH 1.2 // K/W
+#define HS_CTH 300.0 // J/K
+#define TEMP_K 273.15
+#define TEMP_0 298.15 // NTC 100k at 25C, B 3950, below 68k to the A/D reference, as in tools/units.c
+#define TEMP_R0 100000.0
+#define TEMP_B 3950.0
+#define TEMP_RDIV 68000.0
+#define IGBT_VCE 1.5 // V
+#define IGBT_ESW 2e-7 // J per V*A per switching period (on + off)
+#define IGBT_FO_CURRENT 20.0 // A
+
+// PV string instead of the mains, I = Isc * G - I0 * exp(V / a)
+#define PV_VOC 340.0 // V at 1000 W/m2, 9 modules
+#define PV_SLOPE 20.0 // V, a
+#define PV_CLOUD 0.35 // first cloud at this fraction of the day
+
+#define VS_TAU 0.01 // s, output volt-seconds filter, one mains half-cycle
+#define VS_BAND 0.02 // settled volt-seconds error after a bus step
+
+struct sDemand {
+	double t; // s
+	double lpm; // l/min at 3 bar
+};
+
+const struct sDemand demandStep[] = {
+	{ 0, 0 }, { 20, 10 }, { 80, 0 }, { 140, 4 }, { 200, 16 }, { 260, 0 }
+};
+
+// one hour of household use
+const struct sDemand demandDay[] = {
+	{ 0, 0 }, { 60, 5 }, { 90, 0 }, { 300, 9 }, { 660, 0 }, { 900, 3 }, { 930, 0 },
+	{ 1200, 6 }, { 1215, 0 }, { 1500, 15 }, { 2400, 0 }, { 2700, 4 }, { 2760, 0 },
+	{ 3000, 12 }, { 3060, 2 }, { 3300, 0 }
+};
+
+// irrigation through the middle of a one hour PV day (-t 3600 -u)
+const struct sDemand demandSolar[] = {
+	{ 0, 0 }, { 600, 12 }, { 3000, 0 }
+};
+
+struct sMains {
+	double t; // s
+	double v; // RMS
+};
+
+// sags recorded on a rural line, 0.2 to 5 s long (-t 300)
+const struct sMains mainsDips[] = {
+	{ 0, 230 }, { 30, 150 }, { 31, 230 }, { 60, 100 }, { 60.5, 230 }, { 100, 120 }, { 102, 230 },
+	{ 150, 90 }, { 150.2, 230 }, { 200, 140 }, { 205, 230 }, { 250, 110 }, { 250.3, 225 }, { 251, 230 }
+};
+
+// peripherals
+static struct st_io regIo;
+static struct st_tz regTz;
+static struct st_tzn regTz0, regTz1;
+static struct st_ad regAd;
+static struct st_sci3 regSci3;
+static struct st_wdt regWdt;
+static union un_ckcsr regCkcsr;
+static union un_bits8 regMstcr1, regMstcr2, regIegr1, regIenr1;
+static union un_irr1 regIrr1;
+static struct st_tb1 regTb1;
+static union un_ienr2 regIenr2;
+static union un_irr2 regIrr2;
+
+// simulator state
+static uint64_t simCyc, simEnd, simNext;
+static uint8_t simDirty;
+static uint8_t simImask, simInIsr, simStarted;
+static uint8_t costOn, costIsr; // -c, in a handler
+static uint64_t costCyc, costBlocks; // weighed cycles not yet added to simCyc, blocks run
+static uint64_t z0Start, z1Start, z1LastA;
+static int32_t z0Pos;
+static uint64_t tb1Next;
+static uint8_t tb1Load = 0xff;
+static uint16_t z0Match[3]; // U, V, W
+static uint64_t adcDone;
+static uint8_t adcBusy;
+static uint16_t adcHeld; // sampled when the conversion starts
+static uint64_t presNext, presEdge;
+static double presJitter; // pressure sensor edge jitter, peak-to-peak in s
+static uint64_t wdtKick, wdtMax, wdtRunMax; // wdtRunMax: after the boot screens
+static uint8_t wdtShown, wdtResets;
+static uint8_t lastPdr1, lastPdr5, lastPdr8, lastTstr;
+static uint32_t seed = 1;
+
+// LCD
+static char lcdDdram[2][17];
+static uint8_t lcdAddr, lcdCgram;
+static uint64_t lcdLast;
+static uint32_t lcdBytes, lcdTooFast;
+
+// EEPROM 93C66, x8 organization
+static uint8_t eepMem[512];
+static uint8_t romState, romBits, romOut, romEnabled;
+static uint16_t romCmd, romAddr;
+static uint64_t eepBusy;
+static uint64_t romBootFirst, romBootLast; // EEPROM clocks during the first second
+static uint32_t romBootClocks;
+enum romStateEnum { ROM_IDLE, ROM_START, ROM_CMD, ROM_READ, ROM_DATA };
+
+// plant
+static double motPsiS[2], motPsiR[2], motW, motI[3], motTe, motJ = MOT_J;
+static double motIEnd[3]; // phase currents at the end of the last carrier period, motI at its start
+static double ripM[3], ripT, ripV; // switch-on positions, length and bus voltage of the last carrier period
+static double busV, busIdc, busVrms = 230, busPhase;
+static double busStepT = -1, busStepV;
+static const struct sMains *mains;
+static int nMains;
+static double jamT = -1;
+static double spikeT = -1, spikeFreq = 999; // load spike at spikeT, lowest output frequency from it
+static double dryT = -1, dryOn, dryTrip, dryRun; // prime lost at dryT, running dry from dryOn, FAULT_DRY at dryTrip
+static double pvWatts, pvIsc, pvMppV, pvMppP, sunG;
+static double tankW, presBar, pumpQ, demandQ;
+static double hsTemp, ambTemp = 30;
+static uint8_t flowSw;
+static const struct sDemand *demand;
+static int nDemand;
+static double demandLpm = 6;
+
+// statistics
+static double stDt, stEnergy, stEnergySrc, stVolOut, stVolPump, stRun;
+static double stPresSum, stPresErr2, stPresMin = 99, stPresMax, stDemandT;
+static double stFreqSum, stFluxSum, stTempMax, stCurMax, stBusMax, stSwitch, stLoss;
+static uint32_t stStarts, stFaults;
+static uint16_t stFaultMask;
+static uint8_t stLastRun;
+static uint16_t stLastFault;
+static uint64_t isrZ0Max[2], isrZ0Sum[2], isrZ0Cnt[2]; // compare match only, with IMFA
+static uint64_t isrAdiSum, isrAdiCnt;
+static uint64_t pinStart, pinMax, pinSum, pinCnt; // P87 duration measurement pulse
+static double stDispPow;
+static uint32_t stGrLate, stGrMatch; // compare values at or below GRA that did not match in their period, all of them
+static uint8_t z0Off; // outputs were off at the start of this period
+static double stCurMeas, stCurTrue, stCurErr2, stCurN, curWin, curWinN; // DC link current, firmware against model
+static double stReadErr2, stReadN; // pFine against the pressure at the sensor
+static uint8_t lastCurN;
+static double stPvAvail; // energy at the PV maximum power point
+static double stFlowEst, stFlowTrue, stFlowErr2, stFlowN, flowWin, flowWinT; // pump flow, estimate against model
+static uint16_t lastFlowTick;
+static double vsErr, vsPeak, vsSettle; // output volt-seconds error after the bus step
+static double tripOver[2], tripLat[2]; // OC, OV: model past the fast trip level, outputs off after that
+static uint8_t lastToer;
+
+// step response of each demand segment, pressure sampled every 10ms
+#define SEG_MAX 360000
+#define SEG_BAND 0.05 // bar
+static float segPres[SEG_MAX];
+static uint32_t segN;
+static double segStart, segLpm, segNext;
+static double stSettleSum, stOvershootSum;
+static uint32_t stSegments;
+
+// logging
+static FILE *logFile;
+static double logInterval = 0.1, logNext;
+
+static void simRun(void);
+
+static double simTime(void) {
+	return simCyc / SIM_F_CPU;
+}
+
+static double simRand(void) {
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 8) & 0xffff) / 65536.0 - 0.5;
+}
+
+#ifdef SIM_COST
+// built with -DSIM_COST -fsanitize-coverage=trace-pc every basic block of the program calls
+// __sanitizer_cov_trace_pc(); the cost of each block, from that call up to the next one, is
+// read once from the objdump listing of the simulator itself; the register accessors and the
+// rest of the simulator (sim*) cost nothing here
+struct sCostBlock {
+	uintptr_t pc; // return address of the call
+	uint32_t cyc;
+};
+
+static struct sCostBlock *costBlock;
+static uint32_t nCostBlock;
+static uintptr_t costBase; // load address of the listing
+
+extern "C" __attribute__((no_sanitize_coverage)) void __sanitizer_cov_trace_pc(void) {
+	uintptr_t pc;
+	uint32_t lo, hi, mid;
+
+	if (!costIsr) return;
+	pc = (uintptr_t) __builtin_return_address(0) - costBase;
+	lo = 0;
+	hi = nCostBlock;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (costBlock[mid].pc <= pc) lo = mid;
+		else hi = mid;
+	}
+	if (nCostBlock && costBlock[lo].pc == pc) costCyc += costBlock[lo].cyc;
+	costBlocks++;
+}
+
+static uint32_t costInsn(const char *op) {
+	uint16_t n;
+
+	n = strlen(op);
+	if (!strncmp(op, "imul", 4) || !strncmp(op, "mul", 3)) return SIM_COST_MUL_CYCLES;
+	if (!strncmp(op, "idiv", 4) || (!strncmp(op, "div", 3) && n < 5)) return SIM_COST_DIV_CYCLES;
+	if (!strncmp(op, "cvt", 3) || (n > 3 && strncmp(op, "mov", 3) && (!strcmp(op + n - 2, "ss") || !strcmp(op + n - 2, "sd"))))
+		return SIM_COST_FLOAT_CYCLES;
+	return SIM_COST_CYCLES;
+}
+
+static int costInit(void) {
+	FILE *f;
+	char line[512], op[32], *p;
+	unsigned long addr;
+	uint32_t n, open, fw;
+	uintptr_t self;
+
+	sprintf(line, "objdump -d -C --no-show-raw-insn /proc/%d/exe", (int) getpid());
+	f = popen(line, "r");
+	if (!f) return -1;
+	n = 0;
+	open = 0;
+	fw = 0;
+	self = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx <%31[^>]>:", &addr, op) == 2) { // function start
+			if (!strcmp(op, "__sanitizer_cov_trace_pc")) self = addr;
+			fw = strncmp(op, "sim", 3);
+			open = 0;
+			continue;
+		}
+		if (sscanf(line, " %lx:\t%31s", &addr, op) != 2) continue;
+		if (open == 2) { // the instruction after the call starts the block
+			if (!(n & 1023)) costBlock = (struct sCostBlock *) realloc(costBlock, (n + 1024) * sizeof(*costBlock));
+			costBlock[n].pc = addr;
+			costBlock[n++].cyc = 0;
+			open = 1;
+		}
+		p = strchr(line, '<');
+		if (!strncmp(op, "call", 4) && p && !strncmp(p, "<__sanitizer_cov_trace_pc>", 26)) {
+			open = fw ? 2 : 0;
+			continue;
+		}
+		if (open) costBlock[n - 1].cyc += costInsn(op);
+		if (!strncmp(op, "ret", 3) || !strcmp(op, "jmp")) open = 0;
+	}
+	pclose(f);
+	if (!n || !self) return -1;
+	costBase = (uintptr_t) __sanitizer_cov_trace_pc - self;
+	nCostBlock = n;
+	return 0;
+}
+#else
+static int costInit(void) {
+	return -1;
+}
+#endif
+
+// pageDef takes register addresses during static initialization, before main()
+static void simAccess(void) {
+	uint8_t isr;
+
+	if (!simStarted) return;
+	isr = costIsr;
+	costIsr = 0;
+	simCyc += costOn ? SIM_COST_ACCESS_CYCLES + costCyc : SIM_ACCESS_CYCLES;
+	costCyc = 0;
+	simRun();
+	costIsr = isr;
+}
+
+// the weighed code of a handler ends with its return
+static void costEnd(void) {
+	costIsr = 0;
+	simCyc += costCyc;
+	costCyc = 0;
+}
+
+struct st_io *simIo(void) { simAccess(); return &regIo; }
+struct st_tz *simTz(void) { simAccess(); simDirty = 1; return &regTz; }
+struct st_tzn *simTz0(void) {
+	simAccess();
+	simDirty = 1;
+	if (regTz.TSTR.BYTE & 1) regTz0.TCNT = simCyc - z0Start;
+	return &regTz0;
+}
+
+struct st_tzn *simTz1(void) {
+	simAccess();
+	simDirty = 1;
+	if (regTz.TSTR.BYTE & 2) regTz1.TCNT = (simCyc - z1Start) / 8;
+	return &regTz1;
+}
+
+struct st_tb1 *simTb1(void) { simAccess(); return &regTb1; }
+struct st_ad *simAd(void) { simAccess(); return &regAd; }
+struct st_sci3 *simSci3(void) { simAccess(); return &regSci3; }
+struct st_wdt *simWdt(void) { simAccess(); return &regWdt; }
+union un_ckcsr *simCkcsr(void) { simAccess(); return &regCkcsr; }
+union un_bits8 *simMstcr1(void) { simAccess(); return &regMstcr1; }
+union un_bits8 *simMstcr2(void) { simAccess(); return &regMstcr2; }
+union un_bits8 *simIegr1(void) { simAccess(); return &regIegr1; }
+union un_bits8 *simIenr1(void) { simAccess(); return &regIenr1; }
+union un_irr1 *simIrr1(void) { simAccess(); return &regIrr1; }
+union un_ienr2 *simIenr2(void) { simAccess(); return &regIenr2; }
+union un_irr2 *simIrr2(void) { simAccess(); return &regIrr2; }
+
+void set_imask_ccr(uint8_t mask) {
+	simImask = mask;
+	if (!mask) simRun();
+}
+
+/* ********************************* */
+/* ** Plant model ****************** */
+/* ********************************* */
+
+static double presFromWater(double w) {
+	double vGas;
+
+	if (w < TANK_PRECHARGE * PIPE_COMPLIANCE) return w / PIPE_COMPLIANCE;
+	vGas = TANK_VOL - (w - TANK_PRECHARGE * PIPE_COMPLIANCE);
+	if (vGas < TANK_VOL * 0.05) vGas = TANK_VOL * 0.05;
+	return (TANK_PRECHARGE + 1) * TANK_VOL / vGas - 1;
+}
+
+static double waterFromPres(double p) {
+	if (p < TANK_PRECHARGE) return p * PIPE_COMPLIANCE;
+	return TANK_PRECHARGE * PIPE_COMPLIANCE + TANK_VOL - (TANK_PRECHARGE + 1) * TANK_VOL / (p + 1);
+}
+
+static double mainsAt(double t) {
+	int i;
+	double v;
+
+	v = busVrms;
+	for (i = 0; i < nMains && mains[i].t <= t; i++) v = mains[i].v;
+	return v;
+}
+
+static double demandAt(double t) {
+	int i;
+	double lpm;
+
+	if (!demand) return demandLpm;
+	lpm = 0;
+	for (i = 0; i < nDemand && demand[i].t <= t; i++) lpm = demand[i].lpm;
+	return lpm;
+}
+
+// settling time into a +-SEG_BAND window around the mean of the last fifth
+// of the segment, overshoot past that value in the direction of the step
+static void segAnalyze(void) {
+	double final, over, settle;
+	uint32_t i, n;
+
+	if (segN < 10) return;
+	n = segN / 5;
+	final = 0;
+	for (i = segN - n; i < segN; i++) final += segPres[i];
+	final /= n;
+	settle = 0;
+	over = 0;
+	for (i = 0; i < segN; i++) {
+		if (fabs(segPres[i] - final) > SEG_BAND) settle = (i + 1) * 0.01;
+		if (segPres[0] < final && segPres[i] - final > over) over = segPres[i] - final;
+		if (segPres[0] > final && final - segPres[i] > over) over = final - segPres[i];
+	}
+	printf("segment %7.0f s %5.1f l/min: %.3f bar, settled in %6.2f s, overshoot %.3f bar\n",
+		segStart, segLpm, final, settle, over);
+	stSettleSum += settle;
+	stOvershootSum += over;
+	stSegments++;
+}
+
+static void segSample(void) {
+	double t, lpm;
+
+	t = simTime();
+	if (t < segNext) return;
+	segNext += 0.01;
+	lpm = demandAt(t);
+	if (lpm != segLpm) {
+		segAnalyze();
+		segStart = t;
+		segLpm = lpm;
+		segN = 0;
+	}
+	if (segN < SEG_MAX) segPres[segN++] = presBar;
+}
+
+// phase current ripple about the period average at position pos, for the switch pattern of the
+// last period: the leakage inductance integrates the phase voltage minus its period average
+static double phaseRipple(int k, double pos) {
+	double f[3], m[3], d, dm;
+	int j;
+
+	if (ripT <= 0 || pos < 0 || pos > ripT) return 0;
+	for (j = 0; j < 3; j++) {
+		f[j] = pos > ripM[j] ? pos - ripM[j] : 0;
+		m[j] = (ripT - ripM[j]) * (ripT - ripM[j]) / (2 * ripT); // mean of f[j] over the period
+	}
+	d = (ripT - ripM[k]) / ripT;
+	dm = (3 * ripT - ripM[0] - ripM[1] - ripM[2]) / (3 * ripT);
+	return ripV / (MOT_LLS + MOT_LLR) / SIM_F_CPU *
+		(f[k] - (f[0] + f[1] + f[2]) / 3 - (d - dm) * pos - (m[k] - (m[0] + m[1] + m[2]) / 3 - (d - dm) * ripT / 2));
+}
+
+// DC link current for the switch states at the given position in the carrier period: the phase
+// currents continue the slope of the last period, with the ripple at the present counter value
+static double busCurrent(int32_t pos) {
+	double i, now;
+	int k;
+
+	i = 0;
+	if (regTz.TOER.BYTE & 0x0e) return 0;
+	now = simCyc - z0Start;
+	for (k = 0; k < 3; k++)
+		if (pos >= z0Match[k])
+			i += motIEnd[k] + (ripT > 0 ? (motIEnd[k] - motI[k]) * now / ripT : 0) + phaseRipple(k, now);
+	return i;
+}
+
+// irradiance over the simulated time as one day, sunrise at the start and sunset at the
+// end, with a long thin cloud and a short dark one
+static double sunAt(double t) {
+	double f, g;
+
+	f = t / (simEnd / SIM_F_CPU);
+	if (f <= 0 || f >= 1) return 0;
+	g = sin(M_PI * f);
+	g *= 1 - 0.5 * exp(-(f - PV_CLOUD) * (f - PV_CLOUD) / 0.002) - 0.8 * exp(-(f - 0.7) * (f - 0.7) / 0.0002);
+	return g;
+}
+
+static double pvCurrent(double v, double g) {
+	double i;
+
+	i = pvIsc * g - pvIsc * exp((v - PV_VOC) / PV_SLOPE);
+	return i > 0 ? i : 0;
+}
+
+// maximum power point by Newton iteration from the last one, d(V * I) / dV = 0
+static void pvMpp(double g) {
+	double e, f, df;
+	int k;
+
+	if (g <= 0) {
+		pvMppP = 0;
+		return;
+	}
+	if (pvMppV <= 0 || pvMppV >= PV_VOC * 1.2) pvMppV = PV_VOC * 0.8;
+	for (k = 0; k < 4; k++) {
+		e = pvIsc * exp((pvMppV - PV_VOC) / PV_SLOPE);
+		f = pvIsc * g - e * (1 + pvMppV / PV_SLOPE);
+		df = -e * (2 + pvMppV / PV_SLOPE) / PV_SLOPE;
+		pvMppV -= f / df;
+	}
+	pvMppP = pvMppV * pvCurrent(pvMppV, g);
+}
+
+static void plantStep(double dt) {
+	double d[3], dm, va, vb, vc, vAlpha, vBeta;
+	double ls, lr, den, isA, isB, irA, irB, we, eA, eB;
+	double a, b, pPump, pShaft, tLoad, src, pLoss, sw;
+	int k, dry;
+
+	// switch duty: phase is connected to the positive rail from the compare match to the end of the period
+	for (k = 0; k < 3; k++) {
+		d[k] = (double) (regTz0.GRA + 1 - z0Match[k]) / (regTz0.GRA + 1);
+		if (d[k] < 0) d[k] = 0;
+	}
+	if (regTz.TOER.BIT.B3) d[0] = 0;
+	if (regTz.TOER.BIT.B2) d[1] = 0;
+	if (regTz.TOER.BIT.B1) d[2] = 0;
+	dm = (d[0] + d[1] + d[2]) / 3;
+	ripT = regTz0.GRA + 1;
+	ripV = busV;
+	for (k = 0; k < 3; k++) ripM[k] = (1 - d[k]) * ripT;
+	// motor terminals a, b, c are wired to U, W, V, forward rotation with rotDir = 0
+	va = (d[0] - dm) * busV;
+	vb = (d[2] - dm) * busV;
+	vc = (d[1] - dm) * busV;
+	vAlpha = va;
+	vBeta = (vb - vc) / sqrt(3.0);
+
+	// induction motor, stationary reference frame, flux linkages as states
+	ls = MOT_LLS + MOT_LM;
+	lr = MOT_LLR + MOT_LM;
+	den = ls * lr - MOT_LM * MOT_LM;
+	isA = (lr * motPsiS[0] - MOT_LM * motPsiR[0]) / den;
+	isB = (lr * motPsiS[1] - MOT_LM * motPsiR[1]) / den;
+	irA = (ls * motPsiR[0] - MOT_LM * motPsiS[0]) / den;
+	irB = (ls * motPsiR[1] - MOT_LM * motPsiS[1]) / den;
+	we = motW * MOT_POLES;
+	eA = (vAlpha - MOT_RS * isA) / (1 + MOT_RS / MOT_RFE);
+	eB = (vBeta - MOT_RS * isB) / (1 + MOT_RS / MOT_RFE);
+	motPsiS[0] += eA * dt;
+	motPsiS[1] += eB * dt;
+	motPsiR[0] += (-MOT_RR * irA - we * motPsiR[1]) * dt;
+	motPsiR[1] += (-MOT_RR * irB + we * motPsiR[0]) * dt;
+	if ((regTz.TOER.BYTE & 0x0e) == 0x0e) { // outputs off, the diodes block the back EMF: no stator current
+		motPsiS[0] = MOT_LM / lr * motPsiR[0];
+		motPsiS[1] = MOT_LM / lr * motPsiR[1];
+		isA = isB = eA = eB = 0;
+	}
+	motTe = 1.5 * MOT_POLES * (motPsiS[0] * isB - motPsiS[1] * isA);
+	isA += eA / MOT_RFE; // terminal current
+	isB += eB / MOT_RFE;
+	motI[0] = isA;
+	motI[2] = -0.5 * isA + sqrt(3.0) / 2 * isB;
+	motI[1] = -0.5 * isA - sqrt(3.0) / 2 * isB;
+	isA = (lr * motPsiS[0] - MOT_LM * motPsiR[0]) / den + eA / MOT_RFE;
+	isB = (lr * motPsiS[1] - MOT_LM * motPsiR[1]) / den + eB / MOT_RFE;
+	motIEnd[0] = isA;
+	motIEnd[2] = -0.5 * isA + sqrt(3.0) / 2 * isB;
+	motIEnd[1] = -0.5 * isA - sqrt(3.0) / 2 * isB;
+
+	// centrifugal pump with check valve
+	a = PUMP_SHUTOFF / (2 * M_PI * 48.5) / (2 * M_PI * 48.5);
+	b = PUMP_SHUTOFF / PUMP_QMAX / PUMP_QMAX;
+	dry = dryT >= 0 && simTime() >= dryT; // air in the impeller
+	pPump = dry ? 0 : a * motW * motW;
+	pumpQ = (motW > 0 && pPump > presBar) ? sqrt((pPump - presBar) / b) : 0;
+	pShaft = pumpQ * presBar * 1e5 / PUMP_ETA;
+	tLoad = (motW > 1 ? pShaft / motW : 0) + PUMP_KD * (dry ? PUMP_KD_AIR : 1) * motW * fabs(motW);
+	if (motW > 0.1) tLoad += MOT_FRICTION;
+	else if (motW < -0.1) tLoad -= MOT_FRICTION;
+	if (spikeT >= 0 && simTime() >= spikeT && simTime() < spikeT + PUMP_SPIKE_TIME) tLoad += PUMP_SPIKE_TORQUE;
+	motW += (motTe - tLoad) / motJ * dt;
+	if (fabs(motW) < 0.1 && fabs(motTe) < MOT_FRICTION) motW = 0;
+	if (jamT >= 0 && simTime() >= jamT) motW = 0; // seized pump
+
+	// pressure vessel and demand through an orifice
+	demandQ = demandAt(simTime()) / 60000 / sqrt(3.0) * sqrt(presBar > 0 ? presBar : 0);
+	tankW += (pumpQ - demandQ) * dt;
+	if (tankW < 0) tankW = 0;
+	presBar = presFromWater(tankW);
+	if (pumpQ * 60000 > FLOW_SW_ON) flowSw = 1;
+	else if (pumpQ * 60000 < FLOW_SW_OFF) flowSw = 0;
+
+	// DC bus fed from rectified mains through the inrush resistor or relay
+	if (busStepT >= 0 && simTime() >= busStepT && busVrms != busStepV) busVrms = busStepV;
+	if (mains) busVrms = mainsAt(simTime());
+	busPhase += 2 * M_PI * 50 * dt;
+	if (busPhase > 2 * M_PI) busPhase -= 2 * M_PI;
+	// the phase currents change linearly through the period, a phase conducts from its compare match
+	busIdc = 0;
+	for (k = 0; k < 3; k++) busIdc += d[k] * (motI[k] + (motIEnd[k] - motI[k]) * (2 - d[k]) / 2);
+	if (pvWatts > 0) {
+		sunG = sunAt(simTime());
+		pvMpp(sunG);
+		src = pvCurrent(busV, sunG);
+	} else {
+		src = busVrms * sqrt(2.0) * fabs(sin(busPhase)) - busV;
+		src = src > 0 ? src / (regIo.PDR1.BIT.B1 ? BUS_R_RELAY : BUS_R_INRUSH) : 0;
+	}
+	busV += (src - busIdc - (busV > 50 ? BUS_AUX_LOAD / busV : 0)) / BUS_CAP * dt;
+	if (busV < 0) busV = 0;
+
+	// IGBT module losses and heatsink
+	sw = 0;
+	for (k = 0; k < 3; k++) {
+		if (z0Match[k] > 0 && z0Match[k] <= regTz0.GRA && d[k] > 0) {
+			sw += fabs(motI[k]);
+			stSwitch += 2;
+		}
+	}
+	pLoss = IGBT_VCE * (fabs(motI[0]) + fabs(motI[1]) + fabs(motI[2])) + IGBT_ESW * busV * sw / dt;
+	stLoss += pLoss * dt;
+	hsTemp += (pLoss - (hsTemp - ambTemp) / HS_RTH) / HS_CTH * dt;
+
+	// module fault output
+	for (k = 0; k < 3; k++)
+		if (fabs(motI[k]) > IGBT_FO_CURRENT) regIrr1.BIT.IRRI1 = 1;
+
+	// the firmware's fast trip levels: phase current over ocTrip, bus voltage over maxVolt
+	if (!(regTz.TOER.BYTE & 0x0e)) {
+		for (k = 0; k < 3; k++)
+			if (!tripOver[0] && fabs(motI[k]) > ocTrip * (125.0 / 9728)) tripOver[0] = simTime();
+		if (!tripOver[1] && busV > maxVolt * (1395.0 / 2816)) tripOver[1] = simTime();
+	}
+
+	// statistics
+	stDt += dt;
+	stEnergy += busV * busIdc * dt;
+	stEnergySrc += src * busV * dt;
+	stPvAvail += pvMppP * dt;
+	stVolOut += demandQ * dt;
+	stVolPump += pumpQ * dt;
+	if (demandAt(simTime()) > 0) {
+		stDemandT += dt;
+		stPresSum += presBar * dt;
+		stPresErr2 += (presBar - param[1] / 10.0) * (presBar - param[1] / 10.0) * dt;
+		if (presBar < stPresMin) stPresMin = presBar;
+	}
+	if (presBar > stPresMax) stPresMax = presBar;
+	stDispPow += dispPow * dt;
+	if (demand) segSample();
+	// measured DC link current against the model current averaged over the same carrier periods
+	if (curN == 0 && lastCurN != 0 && curWinN > 0) {
+		if (vfdRun) {
+			stCurMeas += current * (125.0 / 9728);
+			stCurTrue += curWin / curWinN;
+			stCurErr2 += (current * (125.0 / 9728) - curWin / curWinN) * (current * (125.0 / 9728) - curWin / curWinN);
+			stCurN++;
+		}
+		curWin = curWinN = 0;
+	}
+	lastCurN = curN;
+	// estimated pump flow against the model flow averaged over the same period
+	flowWin += pumpQ * 60000 * dt;
+	flowWinT += dt;
+	if (tFlowEst != lastFlowTick) {
+		if (vfdRun && param[36] && flowWinT > 0) {
+			stFlowEst += flowEst / 10.0;
+			stFlowTrue += flowWin / flowWinT;
+			stFlowErr2 += (flowEst / 10.0 - flowWin / flowWinT) * (flowEst / 10.0 - flowWin / flowWinT);
+			stFlowN++;
+		}
+		flowWin = flowWinT = 0;
+		lastFlowTick = tFlowEst;
+	}
+	curWin += busIdc;
+	curWinN++;
+	if (simTime() > 1) {
+		stReadErr2 += (pFine / 16.0 - 364 - (presBar > 0 ? presBar : 0) / 0.0097031) * (pFine / 16.0 - 364 - (presBar > 0 ? presBar : 0) / 0.0097031) * dt;
+		stReadN += dt;
+	}
+	if (vfdRun) {
+		stRun += dt;
+		stFreqSum += freq * (62.5 / 65536) * dt;
+		stFluxSum += fluxScale / 256.0 * dt;
+	}
+	// output volt-seconds against the firmware's V/f curve and flux optimizer scale, below the modulation limit
+	if (vfdRun && freq && pwmRatio < (251 << pwmShift)) {
+		vsErr += (sqrt(1.5 * (vAlpha * vAlpha + vBeta * vBeta)) / (freqToVolt * VF_LERP(freq) / 16.0 * (62.5 / 256) * fluxScale / 256) - 1 - vsErr) * dt / VS_TAU;
+		if (busStepT >= 0 && simTime() >= busStepT) {
+			if (fabs(vsErr) > vsPeak) vsPeak = fabs(vsErr);
+			if (fabs(vsErr) > VS_BAND) vsSettle = simTime() - busStepT;
+		}
+	}
+	if (vfdRun && !stLastRun) stStarts++;
+	stLastRun = vfdRun;
+	if ((fault | scFault) & ~stLastFault) stFaults++;
+	if (spikeT >= 0 && simTime() >= spikeT && simTime() < spikeT + 2 * PUMP_SPIKE_TIME && freq * (62.5 / 65536) < spikeFreq)
+		spikeFreq = vfdRun ? freq * (62.5 / 65536) : 0;
+	if (dry && vfdRun) {
+		if (!dryOn) dryOn = simTime();
+		dryRun += dt;
+	}
+	if (dryOn && !dryTrip && (fault & FAULT_DRY)) dryTrip = simTime();
+	stLastFault = fault | scFault;
+	stFaultMask |= stLastFault;
+	if (hsTemp > stTempMax) stTempMax = hsTemp;
+	if (fabs(busIdc) > stCurMax) stCurMax = fabs(busIdc);
+	if (busV > stBusMax) stBusMax = busV;
+
+	if (logFile && simTime() >= logNext) {
+		logNext += logInterval;
+		fprintf(logFile, "%.3f,%.3f,%.2f,%.2f,%.2f,%.1f,%.1f,%.3f,%.1f,%.1f,%u,%u,%.2f,%d,%u\n",
+			simTime(), presBar, pumpQ * 60000, demandQ * 60000, freq * (62.5 / 65536),
+			motW * 30 / M_PI, busV, busIdc, busV * busIdc, hsTemp,
+			fault | scFault, vfdRun, reqFreq * (62.5 / 65536), pAct, fluxScale);
+	}
+}
+
+/* ********************************* */
+/* ** Peripherals ****************** */
+/* ********************************* */
+
+static uint16_t adcSample(uint8_t chan) {
+	double v, r;
+
+	switch (chan) {
+	case 3: // NTC divider
+		r = TEMP_R0 * exp(TEMP_B * (1 / (hsTemp + TEMP_K) - 1 / TEMP_0));
+		v = TEMP_RDIV / (r + TEMP_RDIV) * 1024;
+		break;
+	case 4: // DC link shunt, 0.02R x19
+		v = busCurrent(z0Pos) * 9728 / 125;
+		break;
+	case 6: // DC bus divider
+		v = busV * 2816 / 1395;
+		break;
+	default:
+		v = 0;
+	}
+	v += simRand();
+	if (v < 0) v = 0;
+	if (v > 1023) v = 1023;
+	return (uint16_t) v;
+}
+
+static void lcdByte(uint8_t data, uint8_t rs) {
+	lcdBytes++;
+	if (simCyc - lcdLast < 592) lcdTooFast++;
+	lcdLast = simCyc;
+	if (!rs) {
+		if (data & 0x80) {
+			lcdAddr = data & 0x7f;
+			lcdCgram = 0;
+		} else if (data & 0x40) {
+			lcdCgram = 1;
+		} else if (data == 0x01) {
+			memset(lcdDdram, ' ', sizeof(lcdDdram));
+			lcdDdram[0][16] = lcdDdram[1][16] = 0;
+			lcdAddr = 0;
+		}
+	} else if (!lcdCgram) {
+		if ((lcdAddr & 0x3f) < 16) lcdDdram[(lcdAddr >> 6) & 1][lcdAddr & 0x3f] = data;
+		lcdAddr++;
+	}
+}
+
+static void eepClock(uint8_t di) {
+	if (simTime() < 1) {
+		if (!romBootClocks) romBootFirst = simCyc;
+		romBootLast = simCyc;
+		romBootClocks++;
+	}
+	switch (romState) {
+	case ROM_START:
+		if (di) {
+			romState = ROM_CMD;
+			romBits = 0;
+			romCmd = 0;
+		}
+		break;
+	case ROM_CMD:
+		romCmd = (romCmd << 1) | di;
+		if (++romBits < 11) break;
+		romAddr = romCmd & 0x1ff;
+		switch (romCmd >> 9) {
+		case 2: // READ
+			romState = ROM_READ;
+			romOut = eepMem[romAddr];
+			romBits = 8;
+			regIo.PDR5.BIT.B4 = 0; // dummy bit
+			break;
+		case 1: // WRITE
+			romState = ROM_DATA;
+			romBits = 0;
+			romCmd = 0;
+			break;
+		case 3: // ERASE
+			if (romEnabled) {
+				eepMem[romAddr] = 0xff;
+				eepBusy = simCyc + SIM_EEP_WRITE_CYCLES;
+			}
+			romState = ROM_IDLE;
+			break;
+		default:
+			if (((romAddr >> 7) & 3) == 3) romEnabled = 1;
+			if (((romAddr >> 7) & 3) == 0) romEnabled = 0;
+			romState = ROM_IDLE;
+		}
+		break;
+	case ROM_READ:
+		if (!romBits) { // sequential read continues with the next byte
+			romAddr = (romAddr + 1) & 0x1ff;
+			romOut = eepMem[romAddr];
+			romBits = 8;
+		}
+		romBits--;
+		regIo.PDR5.BIT.B4 = (romOut >> romBits) & 1;
+		break;
+	case ROM_DATA:
+		romCmd = (romCmd << 1) | di;
+		if (++romBits < 8) break;
+		if (romEnabled) {
+			eepMem[romAddr] = romCmd;
+			eepBusy = simCyc + SIM_EEP_WRITE_CYCLES;
+		}
+		romState = ROM_IDLE;
+		break;
+	}
+}
+
+// overflow period of timer B1 in CPU cycles
+static uint64_t tb1Period(void) {
+	static const uint16_t div[] = { 8192, 2048, 512, 256, 128, 32, 8, 8 };
+
+	return (uint64_t) (256 - (regTb1.TMB1.BIT.RLD ? regTb1.TCB1.TLB1 : 0)) * div[regTb1.TMB1.BIT.CKS];
+}
+
+static void simPeripherals(void) {
+	uint8_t pdr1, pdr5, wdt, k;
+
+	// P87 is raised for the duration of the timer Z0 handler
+	if ((regIo.PDR8.BYTE & 0x80) && !(lastPdr8 & 0x80)) pinStart = simCyc;
+	if (!(regIo.PDR8.BYTE & 0x80) && (lastPdr8 & 0x80)) {
+		if (simCyc - pinStart > pinMax) pinMax = simCyc - pinStart;
+		pinSum += simCyc - pinStart;
+		pinCnt++;
+	}
+	lastPdr8 = regIo.PDR8.BYTE;
+
+	// trip latency, from the model crossing the trip level to the outputs being disabled
+	if ((regTz.TOER.BYTE & 0x0e) && !(lastToer & 0x0e)) {
+		for (k = 0; k < 2; k++)
+			if (tripOver[k] && !tripLat[k]) tripLat[k] = simTime() - tripOver[k];
+	}
+	lastToer = regTz.TOER.BYTE;
+
+	// LCD latches data on the falling edge of E
+	pdr1 = regIo.PDR1.BYTE;
+	if ((lastPdr1 & 0x80) && !(pdr1 & 0x80)) lcdByte(regIo.PDR3.BYTE, (pdr1 >> 6) & 1);
+	lastPdr1 = pdr1;
+
+	// EEPROM, CS = P57, SK = P56, DI = P55, DO = P54
+	pdr5 = regIo.PDR5.BYTE;
+	if (!(pdr5 & 0x80)) {
+		romState = ROM_IDLE;
+	} else {
+		if (!(lastPdr5 & 0x80)) romState = ROM_START;
+		if ((pdr5 & 0x40) && !(lastPdr5 & 0x40)) eepClock((pdr5 >> 5) & 1);
+		if (romState == ROM_START) regIo.PDR5.BIT.B4 = simCyc >= eepBusy;
+	}
+	lastPdr5 = regIo.PDR5.BYTE;
+
+	// inputs: keys released, external switch closed, flow switch active low
+	regIo.PDR6.BYTE |= 0xc0;
+	regIo.PDR2.BIT.B3 = 1;
+	regIo.PDRB.BIT.B2 = !flowSw;
+
+	regSci3.SSR.BIT.TDRE = 1;
+	regSci3.SSR.BIT.TEND = 1;
+	regCkcsr.BIT.CKSTA = 1;
+
+	// timer start
+	if ((regTz.TSTR.BYTE & 1) && !(lastTstr & 1)) {
+		z0Start = simCyc - regTz0.TCNT;
+		z0Pos = (int32_t) regTz0.TCNT - 1;
+	}
+	if ((regTz.TSTR.BYTE & 2) && !(lastTstr & 2)) z1Start = simCyc - regTz1.TCNT * 8;
+	lastTstr = regTz.TSTR.BYTE;
+
+	// timer B1 runs out of module standby, writing TLB1 restarts the count
+	if (regMstcr2.BYTE & 0x10) {
+		tb1Next = 0;
+	} else if (!tb1Next || regTb1.TCB1.TLB1 != tb1Load) {
+		tb1Load = regTb1.TCB1.TLB1;
+		tb1Next = simCyc + tb1Period();
+		simDirty = 1;
+	}
+
+	// A/D conversion start
+	if ((regAd.ADCSR.BYTE & 0x20) && !adcBusy) {
+		adcBusy = 1;
+		adcHeld = adcSample(regAd.ADCSR.BYTE & 7);
+		adcDone = simCyc + SIM_ADC_CYCLES;
+		simDirty = 1;
+	}
+
+	// watchdog counter, cleared by writing 0
+	if (regWdt.TCWD != wdtShown) {
+		if (simCyc - wdtKick > wdtMax) wdtMax = simCyc - wdtKick;
+		if (simTime() > 3 && simCyc - wdtKick > wdtRunMax) wdtRunMax = simCyc - wdtKick;
+		wdtKick = simCyc;
+	}
+	wdt = (simCyc - wdtKick) / SIM_WDT_DIV > 255 ? 255 : (simCyc - wdtKick) / SIM_WDT_DIV;
+	if (wdt == 255 && wdtShown != 255) wdtResets++;
+	regWdt.TCWD = wdtShown = wdt;
+}
+
+static void simEvents(void) {
+	uint64_t next, t, z1a;
+	int32_t c, gr[3];
+	uint16_t gra;
+	uint8_t k;
+
+	// the next event only moves when timer Z or the A/D converter is written
+	if (simCyc < simNext && !simDirty) return;
+	simDirty = 0;
+	for (;;) {
+		next = UINT64_MAX;
+		gra = regTz0.GRA;
+		gr[0] = regTz0.GRD;
+		gr[1] = regTz0.GRC;
+		gr[2] = regTz0.GRB;
+
+		// timer Z0 compare matches, counter cleared by GRA
+		c = gra;
+		if (regTz.TSTR.BYTE & 1) {
+			for (k = 0; k < 3; k++)
+				if (gr[k] > z0Pos && gr[k] < c) c = gr[k];
+			next = z0Start + c;
+		}
+		// timer Z1 free running at 16MHz / 8, compare match A
+		z1a = z1Start + (uint64_t) regTz1.GRA * 8;
+		if (z1a <= z1LastA) z1a += 0x80000;
+		if (regTz.TSTR.BYTE & 2) {
+			if (z1Start + 0x80000 < next) next = z1Start + 0x80000;
+			if (z1a < next) next = z1a;
+		}
+		if (tb1Next && tb1Next < next) next = tb1Next;
+		if (presNext < next) next = presNext;
+		if (adcBusy && adcDone < next) next = adcDone;
+		if (next > simCyc) {
+			simNext = next;
+			break;
+		}
+
+		if (next == tb1Next) {
+			regIrr2.BIT.IRRTB1 = 1;
+			tb1Next += tb1Period();
+		}
+		if (next == presNext) {
+			regIrr1.BIT.IRRI0 = 1;
+			t = (uint64_t) (64 * (364 + (presBar > 0 ? presBar : 0) / 0.0097031) + simRand() * 16) * 8;
+			presEdge += t;
+			presNext = presEdge + (uint64_t) ((simRand() + 0.5) * presJitter * SIM_F_CPU);
+		}
+		if (adcBusy && next == adcDone) {
+			adcBusy = 0;
+			k = regAd.ADCSR.BYTE & 3;
+			(&regAd.ADDRA)[k] = adcHeld << 6;
+			regAd.ADCSR.BYTE = (regAd.ADCSR.BYTE & ~0x20) | 0x80;
+		}
+		if ((regTz.TSTR.BYTE & 2) && next == z1a) {
+			z1LastA = z1a;
+			regTz1.TSR.BIT.IMFA = 1;
+		}
+		if ((regTz.TSTR.BYTE & 2) && next == z1Start + 0x80000) {
+			z1Start += 0x80000;
+			regTz1.TSR.BIT.OVF = 1;
+		}
+		if ((regTz.TSTR.BYTE & 1) && next == z0Start + c) {
+			for (k = 0; k < 3; k++) {
+				if (gr[k] > z0Pos && gr[k] <= c) {
+					regTz0.TSR.BYTE |= 8 >> k;
+					if (z0Match[k] > gra) z0Match[k] = gr[k];
+				}
+			}
+			z0Pos = c;
+			if (c >= gra) {
+				// no preload buffer: a value written after the counter passed it misses its match;
+				// startVfd() writes them at any counter value before it enables the outputs
+				for (k = 0; k < 3; k++) {
+					if (gr[k] > gra || z0Off) continue;
+					stGrMatch++;
+					if (z0Match[k] > gra) stGrLate++;
+				}
+				z0Off = (regTz.TOER.BYTE & 0x0e) != 0;
+				regTz0.TSR.BIT.IMFA = 1;
+				plantStep((gra + 1) / SIM_F_CPU);
+				z0Start += gra + 1;
+				z0Pos = -1;
+				for (k = 0; k < 3; k++) z0Match[k] = gra + 1;
+			}
+		}
+	}
+}
+
+static void simReport(void);
+
+static void simDispatch(void) {
+	uint64_t start;
+	uint8_t imfa;
+
+	for (;;) {
+		start = simCyc;
+		simInIsr = 1;
+		simCyc += SIM_ISR_CYCLES;
+		if (regIrr1.BIT.IRRI0 && (regIenr1.BYTE & 1)) {
+			costIsr = costOn;
+			INT_IRQ0();
+			costEnd();
+		} else if (regIrr1.BIT.IRRI1 && (regIenr1.BYTE & 2)) {
+			costIsr = costOn;
+			INT_IRQ1();
+			costEnd();
+		} else if ((regAd.ADCSR.BYTE & 0xc0) == 0xc0) {
+			costIsr = costOn;
+			INT_ADI();
+			costEnd();
+			isrAdiSum += simCyc - start;
+			isrAdiCnt++;
+		} else if (regTz0.TSR.BYTE & regTz0.TIER.BYTE & 0x1f) {
+			imfa = regTz0.TSR.BIT.IMFA;
+			costIsr = costOn;
+			INT_TimerZ0();
+			costEnd();
+			if (simCyc - start > isrZ0Max[imfa]) isrZ0Max[imfa] = simCyc - start;
+			isrZ0Sum[imfa] += simCyc - start;
+			isrZ0Cnt[imfa]++;
+		} else if (regTz1.TSR.BYTE & regTz1.TIER.BYTE & 0x1f) {
+			costIsr = costOn;
+			INT_TimerZ1();
+			costEnd();
+		} else if (regIrr2.BIT.IRRTB1 && regIenr2.BIT.IENTB1) {
+			costIsr = costOn;
+			INT_TimerB1();
+			costEnd();
+		} else {
+			simCyc = start;
+			simInIsr = 0;
+			return;
+		}
+		simInIsr = 0;
+		simEvents();
+		if (simCyc >= simEnd) break; // handlers that never leave time for the main loop
+	}
+}
+
+static void simRun(void) {
+	simPeripherals();
+	simEvents();
+	if (simInIsr) return;
+	if (!simImask) simDispatch();
+	if (simCyc >= simEnd) {
+		simReport();
+		exit(0);
+	}
+}
+
+/* ********************************* */
+/* ** Setup and report ************* */
+/* ********************************* */
+
+static void simReport(void) {
+	if (demand) {
+		segAnalyze();
+		printf("step response       %10.2f s mean settling, %.3f bar mean overshoot\n",
+			stSegments ? stSettleSum / stSegments : 0, stSegments ? stOvershootSum / stSegments : 0);
+	}
+	printf("simulated time      %10.1f s\n", stDt);
+	printf("pump running        %10.1f s\n", stRun);
+	printf("starts              %10u\n", stStarts);
+	printf("mean run frequency  %10.2f Hz\n", stRun > 0 ? stFreqSum / stRun : 0);
+	printf("mean flux scale     %10.1f %% of the V/f curve\n", stRun > 0 ? stFluxSum / stRun * 100 : 0);
+	if (eepMem[paramDef[35].eepAddr]) // requested with -p 35=1
+		printf("base calibration    %10u points, Base %u Hz, Min %u Hz, No-flow power %u W\n", calResult, param[5], param[6], param[36]);
+	printf("DC energy           %10.2f Wh\n", stEnergy / 3600);
+	printf("mains energy        %10.2f Wh\n", stEnergySrc / 3600);
+	printf("mean DC power       %10.1f W (dispPow %.1f W)\n",
+		stDt > 0 ? stEnergy / stDt : 0, stDt > 0 ? stDispPow / stDt : 0);
+	printf("DC current          %10.3f A measured, %.3f A true, %.3f A rms error\n",
+		stCurN > 0 ? stCurMeas / stCurN : 0, stCurN > 0 ? stCurTrue / stCurN : 0,
+		stCurN > 0 ? sqrt(stCurErr2 / stCurN) : 0);
+	printf("pressure reading    %10.2f mbar rms error\n",
+		stReadN > 0 ? sqrt(stReadErr2 / stReadN) * 9.7031 : 0);
+	if (stFlowN > 0)
+		printf("pump flow           %10.2f l/min estimated, %.2f l/min true, %.2f l/min rms error\n",
+			stFlowEst / stFlowN, stFlowTrue / stFlowN, sqrt(stFlowErr2 / stFlowN));
+	if (pvWatts > 0)
+		printf("PV energy           %10.2f Wh harvested of %.2f Wh at the MPP (%.1f%%)\n",
+			stEnergySrc / 3600, stPvAvail / 3600, stPvAvail > 0 ? stEnergySrc / stPvAvail * 100 : 0);
+	printf("water delivered     %10.2f l\n", stVolOut * 1000);
+	printf("water pumped        %10.2f l\n", stVolPump * 1000);
+	printf("specific energy     %10.1f Wh/m3\n", stVolPump > 0 ? stEnergy / 3600 / stVolPump : 0);
+	printf("pressure at demand  %10.3f bar mean, %.3f bar min, %.3f bar rms error\n",
+		stDemandT > 0 ? stPresSum / stDemandT : 0, stDemandT > 0 ? stPresMin : 0,
+		stDemandT > 0 ? sqrt(stPresErr2 / stDemandT) : 0);
+	printf("max pressure        %10.3f bar\n", stPresMax);
+	printf("max DC current      %10.2f A\n", stCurMax);
+	printf("max DC bus voltage  %10.1f V\n", stBusMax);
+	printf("max heatsink temp.  %10.1f C\n", stTempMax);
+	printf("IGBT switching      %10.0f /s while running, %.1f W mean loss\n",
+		stRun > 0 ? stSwitch / stRun : 0, stDt > 0 ? stLoss / stDt : 0);
+	if (busStepT >= 0)
+		printf("bus step            %10.3f s to %.0f%% volt-seconds error, %.1f%% peak\n",
+			vsSettle, VS_BAND * 100, vsPeak * 100);
+	printf("fault events        %10u (mask 0x%02x)\n", stFaults, stFaultMask);
+	if (spikeT >= 0)
+		printf("load spike          %10.2f Hz lowest output frequency\n", spikeFreq);
+	if (dryT >= 0) {
+		if (dryTrip)
+			printf("dry run trip        %10.1f s after the pump ran dry\n", dryTrip - dryOn);
+		else
+			printf("dry run trip        %10s, %.1f s running dry\n", "none", dryRun);
+	}
+	if (tripOver[0])
+		printf("OC trip latency     %10.3f ms after a phase current of %.1f A\n",
+			tripLat[0] * 1000, ocTrip * (125.0 / 9728));
+	if (tripOver[1])
+		printf("OV trip latency     %10.3f ms after a bus voltage of %.0f V\n",
+			tripLat[1] * 1000, maxVolt * (1395.0 / 2816));
+	printf("timer Z0 ISR IMFA   %10.0f cycles mean, %llu cycles max\n",
+		isrZ0Cnt[1] ? (double) isrZ0Sum[1] / isrZ0Cnt[1] : 0, (unsigned long long) isrZ0Max[1]);
+	printf("timer Z0 ISR GRx    %10.0f cycles mean, %llu cycles max\n",
+		isrZ0Cnt[0] ? (double) isrZ0Sum[0] / isrZ0Cnt[0] : 0, (unsigned long long) isrZ0Max[0]);
+	printf("late GRx writes     %10u of %u compare matches\n", stGrLate, stGrMatch);
+	printf("A/D ISR             %10.0f cycles mean, %.0f conversions/s, %.1f%% CPU\n",
+		isrAdiCnt ? (double) isrAdiSum / isrAdiCnt : 0, stDt > 0 ? isrAdiCnt / stDt : 0,
+		stDt > 0 ? isrAdiSum / SIM_F_CPU / stDt * 100 : 0);
+	if (costOn)
+		printf("weighed ISR code    %10.0f basic blocks/s\n", stDt > 0 ? costBlocks / stDt : 0);
+	if (pinCnt)
+		printf("P87 pulse           %10.0f cycles mean, %llu cycles max\n",
+			(double) pinSum / pinCnt, (unsigned long long) pinMax);
+	printf("watchdog            %10.1f ms max kick interval, %u overflows\n",
+		wdtMax / SIM_F_CPU * 1000, wdtResets);
+	printf("main loop           %10.2f ms max pass after 3 s\n", wdtRunMax / SIM_F_CPU * 1000);
+	printf("EEPROM at boot      %10.2f ms, %u clocks\n", (romBootLast - romBootFirst) / SIM_F_CPU * 1000, romBootClocks);
+	printf("LCD                 %10u bytes, %u too fast\n", lcdBytes, lcdTooFast);
+	printf("LCD screen          [%s]\n", lcdDdram[0]);
+	printf("                    [%s]\n", lcdDdram[1]);
+	if (logFile) fclose(logFile);
+}
+
+static int loadDemand(const char *name) {
+	static struct sDemand buf[4096];
+	FILE *f;
+
+	if (!strcmp(name, "const")) {
+		demand = 0;
+	} else if (!strcmp(name, "step")) {
+		demand = demandStep;
+		nDemand = sizeof(demandStep) / sizeof(demandStep[0]);
+	} else if (!strcmp(name, "day")) {
+		demand = demandDay;
+		nDemand = sizeof(demandDay) / sizeof(demandDay[0]);
+	} else if (!strcmp(name, "solar")) {
+		demand = demandSolar;
+		nDemand = sizeof(demandSolar) / sizeof(demandSolar[0]);
+	} else {
+		f = fopen(name, "r");
+		if (!f) return 1;
+		nDemand = 0;
+		while (nDemand < 4096 && fscanf(f, "%lf %lf", &buf[nDemand].t, &buf[nDemand].lpm) == 2) nDemand++;
+		fclose(f);
+		demand = buf;
+	}
+	return 0;
+}
+
+static int loadMains(const char *name) {
+	static struct sMains buf[4096];
+	FILE *f;
+
+	if (!strcmp(name, "dips")) {
+		mains = mainsDips;
+		nMains = sizeof(mainsDips) / sizeof(mainsDips[0]);
+	} else {
+		f = fopen(name, "r");
+		if (!f) return 1;
+		nMains = 0;
+		while (nMains < 4096 && fscanf(f, "%lf %lf", &buf[nMains].t, &buf[nMains].v) == 2) nMains++;
+		fclose(f);
+		mains = buf;
+	}
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"usage: wilosim [options]\n"
+		"  -t sec     simulated time (600)\n"
+		"  -s name    demand: const, step, day, solar or a file with \"seconds l/min\" lines (const)\n"
+		"  -d lpm     constant demand at 3 bar (6)\n"
+		"  -p n=val   menu parameter override, n is the paramDef index\n"
+		"  -P bar     initial pressure (2.0)\n"
+		"  -a degC    ambient temperature (30)\n"
+		"  -V volts   mains RMS voltage (230)\n"
+		"  -b s=volts mains RMS voltage step at s seconds\n"
+		"  -m name    mains RMS voltage: dips or a file with \"seconds volts\" lines\n"
+		"  -J kgm2    inertia of the motor and pump (0.002)\n"
+		"  -j sec     seize the pump at sec seconds\n"
+		"  -w sec     the pump loses its prime at sec seconds\n"
+		"  -k sec     debris loads the pump for a second at sec seconds\n"
+		"  -n us      pressure sensor edge jitter, peak-to-peak (0)\n"
+		"  -u watts   PV string of this peak power instead of the mains, the run is one day\n"
+		"  -c         handler code costs time, needs -DSIM_COST -fsanitize-coverage=trace-pc\n"
+		"  -e         start with blank EEPROM\n"
+		"  -l file    CSV log\n"
+		"  -i ms      log interval (100)\n"
+		"  -r seed    noise seed\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	int opt, n, v, blank;
+	uint8_t i;
+
+	simEnd = 600 * SIM_F_CPU;
+	presBar = 2.0;
+	blank = 0;
+	memset(eepMem, 0xff, sizeof(eepMem));
+	for (i = 0; i < N_PARAM; i++) param[i] = paramDef[i].def;
+
+	while ((opt = getopt(argc, argv, "t:s:d:p:P:a:V:b:m:J:j:w:k:n:u:cel:i:r:h")) != -1) {
+		switch (opt) {
+		case 't': simEnd = atof(optarg) * SIM_F_CPU; break;
+		case 's': if (loadDemand(optarg)) usage(); break;
+		case 'd': demandLpm = atof(optarg); break;
+		case 'p':
+			if (sscanf(optarg, "%d=%d", &n, &v) != 2 || n < 0 || n >= (int) N_PARAM) usage();
+			param[n] = v;
+			break;
+		case 'P': presBar = atof(optarg); break;
+		case 'a': ambTemp = atof(optarg); break;
+		case 'V': busVrms = atof(optarg); break;
+		case 'm': if (loadMains(optarg)) usage(); break;
+		case 'b': if (sscanf(optarg, "%lf=%lf", &busStepT, &busStepV) != 2) usage(); break;
+		case 'J': motJ = atof(optarg); break;
+		case 'j': jamT = atof(optarg); break;
+		case 'w': dryT = atof(optarg); break;
+		case 'k': spikeT = atof(optarg); break;
+		case 'n': presJitter = atof(optarg) * 1e-6; break;
+		case 'u': pvWatts = atof(optarg); break;
+		case 'c':
+			if (costInit()) usage();
+			costOn = 1;
+			break;
+		case 'e': blank = 1; break;
+		case 'l':
+			logFile = fopen(optarg, "w");
+			if (!logFile) usage();
+			break;
+		case 'i': logInterval = atof(optarg) / 1000; break;
+		case 'r': seed = atoi(optarg); break;
+		default: usage();
+		}
+	}
+
+	// EEPROM image in host byte order, as the firmware reads it
+	if (!blank) {
+		memcpy(eepMem, eepSign, 8);
+		for (i = 0; i < N_PARAM; i++) {
+			eepMem[paramDef[i].eepAddr] = param[i] & 0xff;
+			eepMem[paramDef[i].eepAddr + 1] = param[i] >> 8;
+		}
+		memcpy(eepImage, eepMem, EEP_SIZE);
+		eepImage[EEP_CRC_ADDR >> 1] = eepCrc();
+		memcpy(&eepMem[EEP_CRC_ADDR], &eepImage[EEP_CRC_ADDR >> 1], 2);
+	}
+	memset(lcdDdram, ' ', sizeof(lcdDdram));
+	lcdDdram[0][16] = lcdDdram[1][16] = 0;
+	if (pvWatts > 0) { // Isc for the peak power at full sun
+		pvIsc = 1;
+		pvMpp(1);
+		pvIsc = pvWatts / pvMppP;
+		pvMppV = 0;
+	}
+	tankW = waterFromPres(presBar);
+	hsTemp = ambTemp;
+	regTz0.GRA = regTz0.GRB = regTz0.GRC = regTz0.GRD = 0xffff;
+	regTz.TOER.BYTE = 0xff;
+	for (i = 0; i < 3; i++) z0Match[i] = 0xffff;
+	presNext = presEdge = 1000;
+	if (logFile)
+		fprintf(logFile, "t,pressure,pumpFlow,demand,freq,rpm,busV,busI,power,temp,fault,vfdRun,reqFreq,pAct,fluxScale\n");
+
+	simStarted = 1;
+	wiloMain();
+	return 0;
+}
@@ -0,0 +1,3 @@
+// host replacement for the Renesas typedefine.h
+
+#include <stdint.h>
@@ -1,20 +1,34 @@
 // this code generates the arrays with space-vector PWM waveforms
+//
+// svpwm [bits] [shift] > svpwm.h
+//   table header for wilo.c with 2^bits steps per period (8 = 256 steps)
+//   and amplitude 127 << shift (int16_t tables when shift > 0)
+// svpwm -thd
+//   distortion of the line-to-line voltage synthesized by the firmware
+//   arithmetic for several table sizes, with and without interpolation
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <math.h>
 
-#define STEPS 256
+#define MAX_BITS 12
 #define PER_LINE 16
 #define RANGE 127
 
+#define PWM_MAX 2000 // 8kHz carrier
+#define PWM_SHIFT 1 // pwmShift in wilo.c at 8kHz
+#define INTERP 4 // must match SVPWM_INTERP in wilo.c
+
 float t, u, v, w, d;
 unsigned int i, j;
-int svpwm[3][STEPS];
+int svpwm[3][1 << MAX_BITS];
 
-int main(int argc, char *argv[]) {
+void generate(unsigned int steps, unsigned int shift) {
 	t = 0;
-	for (i = 0; i < STEPS; i++) {
-		t += M_PI * 2 / STEPS;
+	for (i = 0; i < steps; i++) {
+		t += M_PI * 2 / steps;
 		u = sin(t);
 		v = sin(t + M_PI * 2 / 3);
 		w = sin(t + M_PI * 4 / 3);
@@ -22,16 +36,24 @@ int main(int argc, char *argv[]) {
 		if (fabs(v) < fabs(d)) d = v;
 		if (fabs(w) < fabs(d)) d = w;
 		d /= 2;
-		svpwm[0][i] = round((u + d) * 2 / sqrt(3) * RANGE);
-		svpwm[1][i] = round((v + d) * 2 / sqrt(3) * RANGE);
-		svpwm[2][i] = round((w + d) * 2 / sqrt(3) * RANGE);
+		svpwm[0][i] = round((u + d) * 2 / sqrt(3) * (RANGE << shift));
+		svpwm[1][i] = round((v + d) * 2 / sqrt(3) * (RANGE << shift));
+		svpwm[2][i] = round((w + d) * 2 / sqrt(3) * (RANGE << shift));
 	}
+}
+
+void printHeader(unsigned int bits, unsigned int shift) {
+	unsigned int steps = 1 << bits;
+
+	printf("// generated by tools/svpwm.c, do not edit\n\n");
+	printf("#define SVPWM_BITS %u // %u steps per period\n", bits, steps);
+	printf("#define SVPWM_SHIFT %u // amplitude %u\n\n", shift, RANGE << shift);
 	for (j = 0; j < 3; j++) {
-		printf("const int8_t svpwm%c[] = {\n", 'U' + j, STEPS);
-		for (i = 0; i < STEPS; i++) {
+		printf("const %s svpwm%c[] = {\n", shift ? "int16_t" : "int8_t", 'U' + j);
+		for (i = 0; i < steps; i++) {
 			if (i % PER_LINE == 0) printf("\t");
 			printf("%i", svpwm[j][i]);
-			if (i < STEPS - 1) {
+			if (i < steps - 1) {
 				printf(",");
 				if (i % PER_LINE == PER_LINE - 1)
 					printf("\n");
@@ -41,5 +63,82 @@ int main(int argc, char *argv[]) {
 		}
 		printf("\n};\n\n");
 	}
+}
+
+// compare value as computed in INT_TimerZ0
+int16_t compare(int k, uint16_t fineIndex, int16_t pwmRatio, unsigned int bits, unsigned int shift, int interp) {
+	unsigned int frac = 16 - bits, mask = (1 << bits) - 1;
+	uint16_t index, next;
+	int16_t val;
+
+	index = (fineIndex >> frac) & mask;
+	if (!interp)
+		return ((int32_t) svpwm[k][index] * pwmRatio >> (6 + shift)) + PWM_MAX / 2;
+	next = (index + 1) & mask;
+	val = (svpwm[k][index] << INTERP) +
+		((int32_t) (int16_t) (svpwm[k][next] - svpwm[k][index]) * (uint16_t) (fineIndex & ((1 << frac) - 1)) >> (frac - INTERP));
+	return ((int32_t) val * pwmRatio >> (6 + shift + INTERP)) + PWM_MAX / 2;
+}
+
+// THD+N of the U-V voltage averaged over each carrier period, over a whole number of cycles
+double thd(uint16_t freq, unsigned int bits, unsigned int shift, int interp) {
+	uint16_t fineIndex, fineStep, freqToPwm;
+	int16_t pwmRatio;
+	uint32_t n, len, g;
+	double x, re, im, mean, total, fund, a;
+
+	freqToPwm = 78; // 230V/50Hz motor on a 325V bus
+	pwmRatio = freq * freqToPwm >> 6;
+	if (pwmRatio > 251) pwmRatio = 251;
+	pwmRatio <<= PWM_SHIFT;
+	fineStep = freq << PWM_SHIFT;
+	for (g = 65536; fineStep % g; g >>= 1) ;
+	len = 65536 / g; // fineIndex repeats after len periods
+	re = im = mean = total = 0;
+	fineIndex = 0;
+	for (n = 0; n < len; n++) {
+		fineIndex += fineStep;
+		x = compare(0, fineIndex, pwmRatio, bits, shift, interp) - compare(1, fineIndex, pwmRatio, bits, shift, interp);
+		a = 2 * M_PI * (double) n * fineStep / 65536;
+		re += x * cos(a);
+		im += x * sin(a);
+		mean += x;
+		total += x * x;
+	}
+	mean /= len;
+	total = total / len - mean * mean;
+	fund = 2 * (re * re + im * im) / len / len;
+	return sqrt((total - fund) / fund) * 100;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned int bits = 8, shift = 0, b, s;
+	const uint16_t freqs[] = { 4, 8, 20, 41, 102, 205 };
+	int k;
 
+	if (argc > 1 && !strcmp(argv[1], "-thd")) {
+		printf("steps  amp  interp");
+		for (k = 0; k < 6; k++) printf("  %5.1fHz", freqs[k] * 62.5 / 256);
+		printf("   THD+N %%\n");
+		for (b = 8; b <= 10; b++) {
+			for (s = 0; s <= 2; s += 2) {
+				generate(1 << b, s);
+				for (j = 0; j < 2; j++) {
+					printf("%5u %4u %7s", 1 << b, RANGE << s, j ? "yes" : "no");
+					for (k = 0; k < 6; k++) printf("  %7.3f", thd(freqs[k], b, s, j));
+					printf("\n");
+				}
+			}
+		}
+		return 0;
+	}
+	if (argc > 1) bits = atoi(argv[1]);
+	if (argc > 2) shift = atoi(argv[2]);
+	if (bits < 6 || bits > MAX_BITS || 16 - bits < INTERP) {
+		fprintf(stderr, "bits must be 6..%u\n", MAX_BITS);
+		return 1;
+	}
+	generate(1 << bits, shift);
+	printHeader(bits, shift);
+	return 0;
 }
@@ -0,0 +1,273 @@
+// this code generates the sensor scaling tables
+//
+// units [bar:Hz ...] > units.h
+//   table header for wilo.c; the pressure sensor is given by two or more calibration
+//   points, pressure in bar and sensor output frequency in Hz, the stock sensor without
+//   points. Between the points the pressure is linear in the sensor period, beyond them
+//   the first and last segment continue
+// units -bench
+//   host timing and error of the float conversions the firmware used before against
+//   the table interpolation it uses now
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#define MAX_POINTS 16
+#define PER_LINE 12
+
+#define Z1_CLOCK 2000000.0 // timer Z1 counts the sensor period at 2MHz
+#define FINE_SHIFT 2 // pFine is the period in timer Z1 ticks >> FINE_SHIFT
+#define PERIOD_MIN 23500 // sensor period range accepted by newPressure() in timer Z1 ticks
+#define PERIOD_MAX 110000
+#define PRES_SHIFT 9 // pFine bits between presTab nodes
+
+#define TEMP_K 273.15
+#define TEMP_0 298.15 // NTC 100k at 25C, B 3950, below 68k to the A/D reference
+#define TEMP_R0 100000.0
+#define TEMP_B 3950.0
+#define TEMP_RDIV 68000.0
+#define TEMP_SHIFT 3 // A/D counts between tempTab nodes
+#define TEMP_LOW -60.0 // tempTab range in C, the NTC runs to infinity at both ends of the A/D range
+#define TEMP_HIGH 250.0
+
+// stock sensor: pAct = 364.71875 + 103.0594 * bar, pAct = period >> 6
+#define STOCK_ZERO 364.71875
+#define STOCK_BAR 103.0594
+
+unsigned int nPoints, i;
+double pointBar[MAX_POINTS], pointPeriod[MAX_POINTS]; // period in timer Z1 ticks
+unsigned int presMin, presNodes, tempNodes;
+int presTab[256], tempTab[256];
+
+// pressure in bar at a sensor period in timer Z1 ticks, linear between the calibration points
+double presAt(double period) {
+	unsigned int k;
+
+	for (k = 1; k < nPoints - 1 && pointPeriod[k] < period; k++) ;
+	return pointBar[k - 1] + (pointBar[k] - pointBar[k - 1]) *
+		(period - pointPeriod[k - 1]) / (pointPeriod[k] - pointPeriod[k - 1]);
+}
+
+// heatsink temperature in C at an A/D value of the NTC divider
+double tempAt(double adc) {
+	double r;
+
+	if (adc <= 0) return TEMP_LOW;
+	if (adc >= 1024) return TEMP_HIGH;
+	r = (1024 - adc) / adc * TEMP_RDIV;
+	r = TEMP_0 * TEMP_B / (TEMP_0 * log(r / TEMP_R0) + TEMP_B) - TEMP_K;
+	return r < TEMP_LOW ? TEMP_LOW : r > TEMP_HIGH ? TEMP_HIGH : r;
+}
+
+int generate() {
+	double v;
+
+	presMin = (PERIOD_MIN >> FINE_SHIFT) & ~((1 << PRES_SHIFT) - 1);
+	presNodes = (((PERIOD_MAX >> FINE_SHIFT) - presMin + (1 << PRES_SHIFT) - 1) >> PRES_SHIFT) + 1;
+	for (i = 0; i < presNodes; i++) {
+		v = round(presAt((double) ((presMin + (i << PRES_SHIFT)) << FINE_SHIFT)) * 1000);
+		if (v < -32768 || v > 32767) {
+			fprintf(stderr, "%.0f mbar at %.2f Hz is out of range\n", v,
+				Z1_CLOCK / ((presMin + (i << PRES_SHIFT)) << FINE_SHIFT));
+			return 1;
+		}
+		presTab[i] = v;
+	}
+	tempNodes = (1024 >> TEMP_SHIFT) + 1;
+	for (i = 0; i < tempNodes; i++)
+		tempTab[i] = round(tempAt(i << TEMP_SHIFT) * 10);
+	for (i = 1; i < presNodes; i++) {
+		if (presTab[i] <= presTab[i - 1]) {
+			fprintf(stderr, "the pressure table does not rise at node %u\n", i);
+			return 1;
+		}
+	}
+	for (i = 1; i < tempNodes; i++) {
+		if (tempTab[i] <= tempTab[i - 1]) {
+			fprintf(stderr, "the temperature table does not rise at node %u\n", i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void printTable(const char *name, int *tab, unsigned int n) {
+	printf("const int16_t %s[] = {\n", name);
+	for (i = 0; i < n; i++) {
+		if (i % PER_LINE == 0) printf("\t");
+		printf("%i", tab[i]);
+		if (i < n - 1) {
+			printf(",");
+			if (i % PER_LINE == PER_LINE - 1)
+				printf("\n");
+			else
+				printf(" ");
+		}
+	}
+	printf("\n};\n\n");
+}
+
+void printHeader() {
+	printf("// generated by tools/units.c, do not edit\n\n");
+	printf("// pressure sensor");
+	for (i = 0; i < nPoints; i++)
+		printf(" %.3gbar:%.2fHz", pointBar[i], Z1_CLOCK / pointPeriod[i]);
+	printf("\n#define PRES_TAB_MIN %u // pFine of the first node\n", presMin);
+	printf("#define PRES_TAB_SHIFT %u // pFine bits between nodes\n", PRES_SHIFT);
+	printf("#define PRES_TAB_NODES %u\n\n", presNodes);
+	printf("// pressure in mbar at the pFine nodes\n");
+	printTable("presTab", presTab, presNodes);
+	printf("// NTC %.0fk at %.0fC, B %.0f, %.0fk divider\n", TEMP_R0 / 1000, TEMP_0 - TEMP_K, TEMP_B, TEMP_RDIV / 1000);
+	printf("#define TEMP_TAB_SHIFT %u // A/D counts between nodes\n", TEMP_SHIFT);
+	printf("#define TEMP_TAB_NODES %u\n\n", tempNodes);
+	printf("// heatsink temperature in 0.1C at the A/D nodes\n");
+	printTable("tempTab", tempTab, tempNodes);
+}
+
+#define PRES_TAB_MIN ((int) presMin) // a plain int literal in units.h
+#define PRES_TAB_SHIFT PRES_SHIFT
+#define PRES_TAB_NODES presNodes
+#define TEMP_TAB_SHIFT TEMP_SHIFT
+#define TEMP_TAB_NODES tempNodes
+
+#include "../lookup.h" // the firmware lookups
+
+#define BENCH_LOOPS 20000000
+
+volatile uint16_t sink;
+volatile float sinkF;
+
+double nsPerCall(clock_t start) {
+	return (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / BENCH_LOOPS;
+}
+
+// display and parameter conversions of the stock sensors, old float path against the tables
+void bench() {
+	uint32_t n;
+	uint16_t adc, r;
+	int16_t pAct, fine;
+	float tempR;
+	double e, eMax;
+	clock_t start;
+
+	printf("conversion              float ns  table ns   max error\n");
+
+	eMax = 0;
+	for (fine = (PERIOD_MIN >> FINE_SHIFT); fine <= (PERIOD_MAX >> FINE_SHIFT); fine++) {
+		e = fabs(presLerp(fine) - ((fine / 16.0) - STOCK_ZERO) / STOCK_BAR * 1000);
+		if (e > eMax) eMax = e;
+	}
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		pAct = 367 + (n & 1023);
+		sink = (float) (pAct - 364) * 0.09703136f;
+	}
+	printf("pressure display     %11.2f", nsPerCall(start));
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		fine = 5875 + (n & 16383);
+		sink = (presLerp(fine) + 50) / 100;
+	}
+	printf(" %9.2f %8.2f mbar\n", nsPerCall(start), eMax);
+
+	eMax = 0;
+	for (adc = 8; adc < 1016; adc++) {
+		e = fabs(tempLerp(adc) - tempAt(adc) * 10) / 10;
+		if (tempAt(adc) > 0 && tempAt(adc) < 150 && e > eMax) eMax = e;
+	}
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		adc = 172 + (n & 511);
+		tempR = (float) (1024 - adc) / adc * TEMP_RDIV;
+		sink = TEMP_0 * TEMP_B / (TEMP_0 * logf(tempR / TEMP_R0) + TEMP_B) - TEMP_K;
+	}
+	printf("temperature display  %11.2f", nsPerCall(start));
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		adc = 172 + (n & 511);
+		sink = (tempLerp(adc) + 5) / 10;
+	}
+	printf(" %9.2f %8.2f C 0-150C\n", nsPerCall(start), eMax);
+
+	eMax = 0;
+	for (r = 5; r <= 100; r++) {
+		e = fabs((presFine(r * 100) / 16.0 - STOCK_ZERO) / STOCK_BAR - r * 0.1) * 1000;
+		if (e > eMax) eMax = e;
+	}
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		r = 5 + (n & 63);
+		sink = 364.71875f + 10.30594f * r;
+	}
+	printf("pressure parameter   %11.2f", nsPerCall(start));
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		r = 5 + (n & 63);
+		sink = (presFine(r * 100) + 8) >> 4;
+	}
+	printf(" %9.2f %8.2f mbar\n", nsPerCall(start), eMax);
+
+	eMax = 0;
+	for (r = 25; r <= 120; r++) {
+		tempR = TEMP_R0 * exp(TEMP_B * ((1 / (r + TEMP_K) - 1 / TEMP_0)));
+		e = fabs(tempAdc(r * 10) - TEMP_RDIV / (tempR + TEMP_RDIV) * 1024);
+		if (e > eMax) eMax = e;
+	}
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		r = 25 + (n & 63);
+		sinkF = TEMP_R0 * expf(TEMP_B * ((1 / ((float) r + TEMP_K) - 1 / TEMP_0)));
+		sink = TEMP_RDIV / (sinkF + TEMP_RDIV) * 1024;
+	}
+	printf("temperature param.   %11.2f", nsPerCall(start));
+	start = clock();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		r = 25 + (n & 63);
+		sink = tempAdc(r * 10);
+	}
+	printf(" %9.2f %8.2f A/D counts\n", nsPerCall(start), eMax);
+	printf("the host has an FPU, on the H8 every float operation is a library call\n");
+}
+
+int main(int argc, char *argv[]) {
+	double bar, hz;
+
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		nPoints = 2;
+	} else {
+		for (nPoints = 0; nPoints + 1 < (unsigned int) argc; nPoints++) {
+			if (nPoints >= MAX_POINTS || sscanf(argv[nPoints + 1], "%lf:%lf", &bar, &hz) != 2 || hz <= 0) {
+				fprintf(stderr, "usage: units [bar:Hz ...] > units.h, up to %u points\n", MAX_POINTS);
+				return 1;
+			}
+			pointBar[nPoints] = bar;
+			pointPeriod[nPoints] = Z1_CLOCK / hz;
+			if (nPoints && (bar <= pointBar[nPoints - 1] || pointPeriod[nPoints] <= pointPeriod[nPoints - 1])) {
+				fprintf(stderr, "the points must rise in pressure and fall in frequency\n");
+				return 1;
+			}
+		}
+		if (nPoints == 1) {
+			fprintf(stderr, "a sensor needs at least two points\n");
+			return 1;
+		}
+	}
+	if (!nPoints) nPoints = 2;
+	if (nPoints == 2 && !pointPeriod[1]) { // stock sensor
+		pointBar[0] = 0;
+		pointPeriod[0] = STOCK_ZERO * 64;
+		pointBar[1] = 10;
+		pointPeriod[1] = (STOCK_ZERO + 10 * STOCK_BAR) * 64;
+	}
+	if (generate()) return 1;
+	if (argc > 1 && !strcmp(argv[1], "-bench")) {
+		bench();
+		return 0;
+	}
+	printHeader();
+	return 0;
+}
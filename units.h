@@ -0,0 +1,34 @@
+// generated by tools/units.c, do not edit
+
+// pressure sensor 0bar:85.68Hz 10bar:22.40Hz
+#define PRES_TAB_MIN 5632 // pFine of the first node
+#define PRES_TAB_SHIFT 9 // pFine bits between nodes
+#define PRES_TAB_NODES 44
+
+// pressure in mbar at the pFine nodes
+const int16_t presTab[] = {
+	-123, 187, 498, 808, 1119, 1429, 1740, 2050, 2361, 2671, 2982, 3292,
+	3603, 3913, 4224, 4534, 4845, 5155, 5466, 5776, 6087, 6397, 6708, 7018,
+	7329, 7639, 7950, 8260, 8571, 8881, 9192, 9502, 9813, 10123, 10434, 10744,
+	11055, 11365, 11676, 11986, 12297, 12607, 12918, 13228
+};
+
+// NTC 100k at 25C, B 3950, 68k divider
+#define TEMP_TAB_SHIFT 3 // A/D counts between nodes
+#define TEMP_TAB_NODES 129
+
+// heatsink temperature in 0.1C at the A/D nodes
+const int16_t tempTab[] = {
+	-600, -501, -409, -351, -308, -273, -243, -218, -195, -174, -155, -137,
+	-121, -106, -91, -77, -64, -52, -39, -28, -17, -6, 5, 15,
+	25, 35, 44, 54, 63, 72, 81, 89, 98, 106, 114, 123,
+	131, 139, 146, 154, 162, 170, 177, 185, 192, 200, 207, 215,
+	222, 229, 237, 244, 251, 259, 266, 273, 281, 288, 295, 302,
+	310, 317, 325, 332, 339, 347, 354, 362, 370, 377, 385, 393,
+	401, 409, 417, 425, 433, 441, 449, 458, 466, 475, 484, 493,
+	502, 511, 521, 530, 540, 550, 560, 570, 581, 592, 603, 614,
+	626, 638, 651, 663, 677, 690, 705, 719, 735, 750, 767, 784,
+	803, 822, 842, 864, 887, 911, 938, 966, 997, 1031, 1069, 1111,
+	1158, 1213, 1278, 1358, 1458, 1593, 1799, 2195, 2500
+};
+
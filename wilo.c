@@ -21,14 +21,73 @@
 #include <stdio.h>
 #include <machine.h>
 #include <mathf.h>
-
-#define TEMP_K 273.15f
-#define TEMP_0 298.15f
-#define TEMP_R0 100000.0f
-#define TEMP_B 3950.0f
-#define TEMP_RDIV 68000.0f
-
-#define PWM_MAX 2000
+#include "svpwm.h" // generated by tools/svpwm.c
+#include "units.h" // generated by tools/units.c
+#include "lookup.h" // sensor scaling on the units.h tables
+
+#define PWM_MAX_16K 1000 // GRA at 16kHz carrier, doubled for each lower carrier
+#define SVPWM_FRAC (16 - SVPWM_BITS) // phase bits below the table index
+#define SVPWM_INTERP 4 // amplitude bits added by interpolation between table entries
+
+// table value interpolated between svpwmIndex and svpwmNext, amplitude 127 << (SVPWM_SHIFT + SVPWM_INTERP)
+#define SVPWM_LERP(table) (((int16_t) table[svpwmIndex] << SVPWM_INTERP) + \
+	((int32_t) (int16_t) (table[svpwmNext] - table[svpwmIndex]) * svpwmFrac >> (SVPWM_FRAC - SVPWM_INTERP)))
+
+#define VF_SHIFT 11 // freq bits between vfTable nodes (1.95Hz)
+#define VF_NODES 33 // covers freq 0-65535 (62.5Hz)
+
+// linear-equivalent frequency of the V/f curve at f, Q4 of 256=62.5Hz, interpolated between vfTable nodes;
+// the node difference is signed, a boosted or 5-point curve may fall between nodes
+#define VF_LERP(f) (vfTable[(f) >> VF_SHIFT] + \
+	((int32_t) (int16_t) (vfTable[((f) >> VF_SHIFT) + 1] - vfTable[(f) >> VF_SHIFT]) * ((f) & ((1 << VF_SHIFT) - 1)) >> VF_SHIFT))
+
+#define ADC_SLOTS 8 // length of the ADC scan schedule, power of 2
+#define CUR_MIN_SEG 64 // active vector time left after the A/D start, covers the A/D sampling time
+#define CUR_START_LAT 160 // timer Z0 counts from the timer Z1 compare match to the A/D start in INT_TimerZ1
+#define LCD_RESYNC 2500 // 4ms ticks between full LCD rewrites (10s)
+#define EEP_SIGN 8 // signature bytes at EEPROM address 0, the parameters follow
+#define EEP_CRC_ADDR 0x64 // CRC of the parameter block, after the last parameter
+#define EEP_SIZE 0x66 // EEPROM image read at boot
+#define EEP_QUEUE 64 // EEPROM write queue length in bytes, power of 2
+#define EEP_BITS 4 // EEPROM clocks per eepProc() call
+#define EEP_BUSY_TIME 3 // 4ms ticks a byte write may take
+#define EEP_TRIES 3 // writes of a byte that does not read back before it counts in eepError
+
+#define REG_PERIOD 25 // PI regulator period in 4ms ticks
+#define REG_STOP_MARGIN 10 // pressure above OFF pressure the PI regulator aims for without flow
+#define REG_MPPT 2 // regMode of the solar MPPT
+#define MPPT_STEP 4 // PV voltage perturbation per regulator period in A/D counts (2V)
+#define MPPT_VOLT_MARGIN 20 // lowest PV voltage above Undervoltage (10V)
+#define MPPT_HOLD 1250 // 5s restart delay after the PV string could not hold Min frequency
+#define FLUX_PERIOD 375 // flux optimizer settling and measurement time in 4ms ticks
+#define FLUX_STEP 6 // voltage scale step, Q8 (2.3%)
+#define FLUX_MIN 154 // lowest voltage scale, Q8 (60%)
+#define FLUX_SETTLE 32 // freq change within a measurement period that rejects it, the pressure loop has not settled (0.03Hz)
+#define FLUX_BAND 768 // freq change that restarts the flux optimizer (0.75Hz)
+#define CAL_FREQ_START 20992 // first calibration step (20Hz)
+#define CAL_STEP 2048 // calibration frequency step (2Hz)
+#define CAL_DWELL 500 // pressure settling check period in 4ms ticks
+#define CAL_SETTLE 2 // pressure change per CAL_DWELL that counts as settled (0.02bar)
+#define CAL_WAIT 15 // CAL_DWELL periods without settling before the calibration gives up
+#define CAL_LIFT 5 // pressure rise above the tank pressure that makes a step a fit point (0.05bar)
+#define CAL_POINTS 4 // fit points that end the calibration
+#define CAL_MARGIN 21 // shut-off head above OFF pressure at Base frequency (0.2bar)
+#define CAL_TIMEOUT 9155 // calibration run time in z1highWord periods before it gives up (300s)
+#define CAL_TIMED_OUT 99 // calResult of a calibration that ran into CAL_TIMEOUT
+#define POW_W (1395.0f / 2816.0f * 125.0f / 9728.0f) // W per voltage * current
+#define FLOW_PERIOD 250 // flow estimate period in 4ms ticks
+#define FLOW_MIN_HEAD 500 // lowest head used by the flow estimate in mbar
+#define FLOW_BAND 768 // freq change within a flow estimate period that keeps the last estimate (0.75Hz)
+#define DRY_TIME 3 // flow estimate periods below the Dry run level that set FAULT_DRY
+#define UV_SHIFT 3 // 256 more freq foldback per 4ms tick for each 1 << UV_SHIFT A/D counts below uvWarn
+#define UV_STEP 512 // largest freq foldback per 4ms tick, sets the braking torque (122Hz/s)
+#define UV_HOLD 250 // 4ms ticks of slow ramp after the bus was below uvWarn (1s)
+#define UV_TRIP_TIME 25 // 4ms ticks below Undervoltage with the ride-through on that set FAULT_UV (0.1s)
+#define OV_RISE 90 // A/D counts the bus may rise above its level at the start of the decel ramp (45V)
+#define OV_MARGIN 16 // A/D counts below Overvoltage the stall level never exceeds (8V)
+#define OV_SHIFT 5 // 256 more freq per 4ms tick back towards the rotor speed for each 1 << OV_SHIFT A/D counts above the stall level
+#define OV_BAND_SHIFT 6 // the decel ramp eases off over 1 << OV_BAND_SHIFT A/D counts below the stall level (32V)
+#define CUR_TRIP_TIME 125 // 4ms ticks above Max current with the current limit on that set FAULT_OC (0.5s)
 
 #define FAULT_SHORT 0x01
 #define FAULT_PRESSURE 0x02
@@ -38,65 +97,10 @@
 #define FAULT_XTAL 0x20
 #define FAULT_TEMP 0x40
 #define FAULT_NO_FLOW 0x80
+#define FAULT_DRY 0x100
 
 enum keyEnum { KEY_NONE, KEY_RUN, KEY_AUTO, KEY_UP, KEY_DOWN, KEY_MENU, KEY_ENTER, KEY_INVALID };
-
-const int8_t svpwmU[] = {
-	5, 11, 16, 22, 27, 32, 38, 43, 48, 53, 59, 64, 69, 74, 79, 84,
-	89, 94, 99, 104, 108, 111, 112, 114, 115, 117, 118, 119, 120, 121, 122, 123,
-	123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127, 127, 127, 127, 126, 126,
-	125, 125, 124, 124, 123, 122, 121, 120, 119, 118, 117, 116, 114, 113, 112, 110,
-	112, 113, 114, 116, 117, 118, 119, 120, 121, 122, 123, 124, 124, 125, 125, 126,
-	126, 127, 127, 127, 127, 127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 123,
-	122, 121, 120, 119, 118, 117, 115, 114, 112, 111, 108, 104, 99, 94, 89, 84,
-	79, 74, 69, 64, 59, 53, 48, 43, 38, 32, 27, 22, 16, 11, 5, 0,
-	-5, -11, -16, -22, -27, -32, -38, -43, -48, -53, -59, -64, -69, -74, -79, -84,
-	-89, -94, -99, -104, -108, -111, -112, -114, -115, -117, -118, -119, -120, -121, -122, -123,
-	-123, -124, -125, -125, -126, -126, -126, -127, -127, -127, -127, -127, -127, -127, -126, -126,
-	-125, -125, -124, -124, -123, -122, -121, -120, -119, -118, -117, -116, -114, -113, -112, -110,
-	-112, -113, -114, -116, -117, -118, -119, -120, -121, -122, -123, -124, -124, -125, -125, -126,
-	-126, -127, -127, -127, -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -123,
-	-122, -121, -120, -119, -118, -117, -115, -114, -112, -111, -108, -104, -99, -94, -89, -84,
-	-79, -74, -69, -64, -59, -53, -48, -43, -38, -32, -27, -22, -16, -11, -5, 0
-};
-
-const int8_t svpwmV[] = {
-	127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 122, 122, 121, 120, 118, 117,
-	116, 115, 113, 112, 111, 107, 102, 97, 92, 87, 83, 77, 72, 67, 62, 57,
-	52, 46, 41, 36, 30, 25, 20, 14, 9, 4, -2, -7, -13, -18, -23, -29,
-	-34, -39, -45, -50, -55, -60, -66, -71, -76, -81, -86, -91, -96, -101, -105, -110,
-	-112, -113, -114, -116, -117, -118, -119, -120, -121, -122, -123, -124, -124, -125, -125, -126,
-	-126, -127, -127, -127, -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -123,
-	-122, -121, -120, -119, -118, -117, -115, -114, -112, -111, -111, -112, -113, -115, -116, -117,
-	-118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127, -127,
-	-127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118, -117,
-	-116, -115, -113, -112, -111, -107, -102, -97, -92, -87, -83, -77, -72, -67, -62, -57,
-	-52, -46, -41, -36, -30, -25, -20, -14, -9, -4, 2, 7, 13, 18, 23, 29,
-	34, 39, 45, 50, 55, 60, 66, 71, 76, 81, 86, 91, 96, 101, 105, 110,
-	112, 113, 114, 116, 117, 118, 119, 120, 121, 122, 123, 124, 124, 125, 125, 126,
-	126, 127, 127, 127, 127, 127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 123,
-	122, 121, 120, 119, 118, 117, 115, 114, 112, 111, 111, 112, 113, 115, 116, 117,
-	118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127
-};
-
-const int8_t svpwmW[] = {
-	-127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118, -117,
-	-116, -115, -113, -112, -111, -111, -112, -114, -115, -117, -118, -119, -120, -121, -122, -123,
-	-123, -124, -125, -125, -126, -126, -126, -127, -127, -127, -127, -127, -127, -127, -126, -126,
-	-125, -125, -124, -124, -123, -122, -121, -120, -119, -118, -117, -116, -114, -113, -112, -110,
-	-105, -101, -96, -91, -86, -81, -76, -71, -66, -60, -55, -50, -45, -39, -34, -29,
-	-23, -18, -13, -7, -2, 4, 9, 14, 20, 25, 30, 36, 41, 46, 52, 57,
-	62, 67, 72, 77, 83, 87, 92, 97, 102, 107, 111, 112, 113, 115, 116, 117,
-	118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127,
-	127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 122, 122, 121, 120, 118, 117,
-	116, 115, 113, 112, 111, 111, 112, 114, 115, 117, 118, 119, 120, 121, 122, 123,
-	123, 124, 125, 125, 126, 126, 126, 127, 127, 127, 127, 127, 127, 127, 126, 126,
-	125, 125, 124, 124, 123, 122, 121, 120, 119, 118, 117, 116, 114, 113, 112, 110,
-	105, 101, 96, 91, 86, 81, 76, 71, 66, 60, 55, 50, 45, 39, 34, 29,
-	23, 18, 13, 7, 2, -4, -9, -14, -20, -25, -30, -36, -41, -46, -52, -57,
-	-62, -67, -72, -77, -83, -87, -92, -97, -102, -107, -111, -112, -113, -115, -116, -117,
-	-118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127, -127
-};
+enum eepStateEnum { EEP_IDLE, EEP_ENABLE, EEP_WRITE, EEP_BUSY, EEP_VERIFY, EEP_DISABLE };
 
 const uint16_t crcTable[] = {
    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
@@ -171,7 +175,32 @@ const struct sParamDef paramDef[] = {
 /* 17 */	{ 0x20, "External switch", "", 0, 0, 0, 2 },
 /* 18 */	{ 0x22, "Ignore faults", "", 0, 0, 0, 1 },
 /* 19 */	{ 0x2c, "LED intensity", "", 0, 5, 1, 6 },
-/* 20 */	{ 0x2e, "Modbus ID", "", 0, 45, 1, 247 }
+/* 20 */	{ 0x2e, "Modbus ID", "", 0, 45, 1, 247 },
+/* 21 */	{ 0x32, "Regulator", "", 0, 1, 0, 2 },
+/* 22 */	{ 0x34, "Set pressure", "bar", 1, 30, 5, 50 },
+/* 23 */	{ 0x36, "Reg. gain", "", 1, 100, 1, 999 },
+/* 24 */	{ 0x38, "Reg. int. time", "s", 1, 100, 1, 600 },
+/* 25 */	{ 0x3a, "PWM mode", "", 0, 0, 0, 1 },
+/* 26 */	{ 0x3c, "PWM frequency", "kHz", 0, 8, 4, 16 },
+/* 27 */	{ 0x3e, "V/f curve", "", 0, 0, 0, 2 },
+/* 28 */	{ 0x40, "V/f boost", "%", 0, 0, 0, 20 },
+/* 29 */	{ 0x42, "V/f point 20%", "%", 0, 20, 0, 120 },
+/* 30 */	{ 0x44, "V/f point 40%", "%", 0, 40, 0, 120 },
+/* 31 */	{ 0x46, "V/f point 60%", "%", 0, 60, 0, 120 },
+/* 32 */	{ 0x48, "V/f point 80%", "%", 0, 80, 0, 120 },
+/* 33 */	{ 0x4a, "V/f point 100%", "%", 0, 100, 0, 120 },
+/* 34 */	{ 0x4c, "Flux optimizer", "", 0, 0, 0, 1 },
+/* 35 */	{ 0x4e, "Calibrate base", "", 0, 0, 0, 1 },
+/* 36 */	{ 0x50, "No-flow power", "W", 0, 0, 0, 999 },
+/* 37 */	{ 0x52, "Pump efficiency", "%", 0, 70, 10, 90 },
+/* 38 */	{ 0x54, "Flow threshold", "l/m", 1, 0, 0, 200 },
+/* 39 */	{ 0x56, "Dry run level", "%", 0, 50, 0, 90 },
+/* 40 */	{ 0x58, "Current limit", "%", 0, 90, 0, 100 },
+/* 41 */	{ 0x5a, "UV ride-through", "V", 0, 20, 0, 100 },
+/* 42 */	{ 0x5c, "Accel time", "s", 1, 8, 1, 600 },
+/* 43 */	{ 0x5e, "Decel time", "s", 1, 8, 1, 600 },
+/* 44 */	{ 0x60, "S-curve", "s", 1, 0, 0, 50 },
+/* 45 */	{ 0x62, "Pressure gate", "ms", 0, 100, 0, 1000 }
 };
 
 uint16_t param[N_PARAM];
@@ -184,6 +213,7 @@ int16_t itemValue;
 const uint8_t degreeSymbol[8] = {0x0c, 0x12, 0x12, 0x0c, 0x00, 0x00, 0x00, 0x00};
 const uint8_t arrowSymbol[8] = {0x04, 0x0e, 0x1f, 0x00, 0x04, 0x0e, 0x1f, 0x00};
 char lcdLine[2][20];
+char lcdShadow[2][16]; // what the LCD shows
 char statusLine[4][20] = {
 	"#.#bar | ##Hz ###",
 	" ###V #.#A ###\001C",
@@ -193,23 +223,46 @@ char statusLine[4][20] = {
 char menuLine[20] = "[######] >######";
 
 uint16_t tLcdSend, tDisp;
-uint8_t lcdRefresh, lcdPos, lcdProcRun;
+uint8_t lcdRefresh, lcdPos, lcdScan; // lcdPos: LCD address counter, lcdScan: next cell to compare
+uint16_t tLcdSync;
 uint16_t dispFreq, dispVolt, dispCur, dispPres, dispTemp, dispPow;
-float tempR;
-uint8_t dispStep;
+uint8_t dispStep, dispPage, dispLines; // page and statusLine rows of this dispProc() cycle
+
+// EEPROM
+uint16_t eepImage[EEP_SIZE / 2]; // RAM mirror of the EEPROM, parameters in the byte order of param
+uint8_t eepQAddr[EEP_QUEUE], eepQData[EEP_QUEUE];
+uint8_t eepHead, eepTail; // eepWrite() queues at eepHead, eepProc() writes eepTail
+uint8_t eepState, eepTry, eepOut, eepIn; // eepOut, eepIn: command bits left to clock
+uint32_t eepShift;
+uint16_t eepPending, eepError; // queued bytes not written yet, bytes that did not read back
+uint16_t tEep;
 
 // VFD
-uint16_t freq, reqFreq; // 256=62.5Hz
+uint16_t freq, reqFreq; // 65536=62.5Hz
+uint32_t accStep, decStep; // freq ramp per 4ms tick, Q8: a slow ramp is below 1 freq per tick
+uint32_t accJerk, decJerk, rampStep; // S-curve: ramp step change per 4ms tick, 0 = linear ramp
+uint32_t rampBrake; // freq the ramp covers while rampStep comes back down to jerk
+uint8_t rampUp;
+uint8_t freqFrac; // the ramp's fraction of freq, Q8
 uint16_t maxFreq;
 uint16_t baseFreq;
 uint16_t minFreq;
 uint16_t stopFreq;
 uint16_t manualFreq;
 float freqToVolt;
-uint16_t freqToPwm;
-uint16_t fineIndex, svpwmIndex;
-uint8_t z0cnt;
-int16_t pwmRatio; // 0-251
+uint32_t voltToPwm; // freqToPwm * voltage
+uint16_t freqToPwm; // pwmRatio per freq, Q14
+uint16_t vfTable[VF_NODES]; // frequency with the same voltage on the linear V/f curve, Q4
+uint16_t fluxScale = 256; // output voltage scale from the flux optimizer, Q8
+uint32_t fineIndex, fineStep; // 2^32 = one cycle
+uint16_t svpwmIndex, svpwmNext;
+int16_t svpwmFrac;
+int16_t pwmRatio; // 0-251 << pwmShift
+uint8_t ratioNew, ratioSeq; // freqToPwm changed in INT_ADI, count of those changes
+uint16_t pwmMax; // carrier period, GRA
+uint8_t pwmShift, pwmCarrier; // carrier 16kHz >> pwmShift, pwmCarrier is applied on next start
+uint16_t pwmGr[3]; // GRD, GRC, GRB for the next carrier period
+uint8_t pwmMode; // 0 = continuous SVPWM, 1 = discontinuous
 uint8_t vfdRun; // PWM output enabled
 uint8_t rotDir;
 
@@ -219,21 +272,56 @@ uint16_t pLowWord, pHighWord;
 uint32_t pTckLast;
 uint8_t pOvf;
 uint16_t tPres;
-uint16_t pRaw[3];
+uint32_t pGate; // reciprocal counter gate time in timer Z1 ticks
+uint32_t pSum; // sensor periods summed in the current gate
+uint8_t pEdges; // sensor edges since the last newPressure()
+uint16_t pCnt; // sensor periods in pSum
+int16_t pFine; // pAct with 4 fraction bits
 int16_t pAct;
+int16_t pMbar; // pressure in mbar from presTab
 int16_t pOn;
 int16_t pOff;
-uint8_t pNew, pIndex;
+uint8_t pNew;
 uint8_t isNewPres;
 
 // flow sensor
 uint8_t flow;
 uint16_t tNoFlow, noFlowTimeout;
+uint16_t flowEst, flowThr; // 0.1 l/min
+uint16_t tFlowEst, flowFreq;
+uint32_t flowEnergy;
+float flowK; // DC power without flow per freq^3, voltage * current
+float flowGain; // flow per DC power and head, 0.1 l/min per voltage * current and mbar
+float dryK; // learned lowest DC power per freq^3 of the running pump, voltage * current
+uint8_t dryLevel, dryCnt;
 
 // regulator
-uint8_t regOn;
+uint8_t regOn, regMode;
+int16_t pSet;
+uint16_t regKp, regTi; // Q4 frequency per pressure unit or Q8 per pFine, 0.1s
+int32_t regInt, regRem; // Q8 frequency, integral step remainder in Q8 frequency * regTi
 uint16_t tReg, tOn, t4ms;
 uint16_t vfdStopDelay;
+int8_t mpptDir;
+uint16_t mpptFreq; // upper limit, lowered above OFF pressure
+uint16_t mpptVolt; // PV voltage held by INT_TimerB1
+uint16_t mpptCur, mpptTick, mpptStop;
+uint32_t mpptPow;
+uint16_t curTotal; // free running sum of the 4ms current averages, differences give longer averages
+uint8_t fluxOn, fluxPhase, fluxMeas; // fluxPhase 0 = base, 1 = probe, 2 = base again
+int8_t fluxDir;
+uint16_t fluxFreq, fluxLast, fluxTick, fluxPeak, fluxProbePeak;
+uint32_t fluxEnergy, fluxPow, fluxProbe;
+uint32_t powTotal; // free running sum of voltage * current every 4ms, no bus ripple in the differences
+uint16_t tSum; // last t4ms tick added to curTotal and powTotal
+
+// Base frequency calibration
+uint8_t calStep, calN, calWait; // calStep 1 = requested, 2 = ramping to a step, 3 = at the step
+uint16_t tCal, tCalStart, calResult; // calResult = fit points of the last calibration, 0 = failed
+int16_t calPres, calTank;
+uint32_t calEnergy;
+float calFF, calFH; // sums of f^4 and h * f^2
+float calF6, calPF; // sums of f^6 and power * f^3
 
 // keyboard
 uint8_t key, lastKey, keyFirst;
@@ -243,19 +331,41 @@ uint8_t tLed, ledIntensity;
 // serial port
 char serialData[256];
 
-// ADC
+// ADC, temperature and voltage follow adcScan with one conversion every other carrier period
+// and are published from INT_ADI after 1 << adcDepth samples; the DC link current is sampled
+// right after the edges that start the two active vectors and averaged over whole periods
+const uint8_t adcChan[3] = { 3, 4, 6 }; // temperature, current, voltage
+const uint8_t adcDepth[3] = { 6, 0, 4 };
+const uint8_t adcScan[ADC_SLOTS] = { 2, 2, 2, 2, 2, 2, 2, 0 };
 uint16_t adcVal[3];
 uint8_t adcCnt[3];
+uint8_t adcSlot;
+uint8_t adcConv; // 0 = adcScan, 1 or 2 = current in the first or second active vector
+uint16_t pwmEdge[3]; // lowest, middle and highest compare value in this carrier period
+uint16_t curAct[2]; // last DC link current sample in each active vector
+uint16_t curSeg; // weight of the sample being converted, twice its vector length plus curPend
+uint16_t curPend[2]; // vector lengths still waiting for the next sample of that vector
+uint8_t curTaken; // current sampled in this carrier period
+uint8_t curVec; // adcConv of the sample INT_TimerZ1 starts
+uint32_t curSum;
+uint8_t curN;
+uint16_t curPeak; // highest phase current sample since the flux optimizer last read it
 uint16_t temp, current, voltage;
 uint16_t minVolt;
 uint16_t maxVolt;
+uint16_t ovStall; // highest bus voltage that stops the decel ramp
+uint16_t decVolt, decFreq; // bus voltage and freq at the start of the decel ramp, decFreq 0 = not decelerating
 uint16_t maxCur;
+uint16_t ocTrip; // phase current sample that trips INT_ADI, twice maxCur within the 10-bit A/D range
+uint16_t curLimit; // stall prevention level, 0 = off
+uint16_t uvWarn; // bus voltage that lowers freq to ride through a dip, 0 = off
+uint16_t tUvWarn; // last tick below uvWarn
+uint8_t freqLimited; // INT_TimerB1 holds or lowers freq for the current limit or uvWarn
 uint16_t maxTemp;
-uint16_t tVoltCalc;
 
 // faults
-uint16_t fault, scFault;
-uint16_t tPresFault, tUv, tOv, tTemp;
+uint16_t fault, scFault; // scFault is set from interrupts only
+uint16_t tPresFault, tUv, tUvTrip, tOv, tTemp, tOc;
 
 // Modbus
 uint8_t mbId, mbReqI, mbIgnore, mbResp, mbRespI, mbRegHi;
@@ -273,7 +383,7 @@ struct sPageDef {
 
 #define N_PAGE (sizeof(pageDef)/sizeof(pageDef[0]))
 #define PAGE_FIRST_FAULT 2
-#define PAGE_LAST_FAULT 9
+#define PAGE_LAST_FAULT 10
 const struct sPageDef pageDef[] = {
 	{ PAGE_STATUS, "", 0 },
 	{ PAGE_STATUS, "", 0 },
@@ -286,12 +396,17 @@ const struct sPageDef pageDef[] = {
 	{ PAGE_FAULT, "Xtal Oscillator", 0 },
 	{ PAGE_FAULT, "IGBT Temperature", 0 },
 	{ PAGE_FAULT, "No Flow Timeout", 0 },
+	{ PAGE_FAULT, "Dry Running", 0 },
 	
 // values for debugging purposes
 	{ PAGE_INT, "clockWait", &clockWait },
 	{ PAGE_HEX16, "startTCWD", &startTCWD },
 	{ PAGE_HEX16, "startTCSRWD", &startTCSRWD },
 	{ PAGE_INT, "freqToPwm", &freqToPwm },
+	{ PAGE_INT, "fluxScale", &fluxScale },
+	{ PAGE_INT, "calResult", &calResult },
+	{ PAGE_INT, "eepPending", &eepPending },
+	{ PAGE_INT, "eepError", &eepError },
 	{ PAGE_INT, "tNoFlow", &tNoFlow },
 	{ PAGE_HEX16, "lastCrc", &lastCrc },
 	{ PAGE_HEX16, "mbCrc", &mbCrc },
@@ -331,7 +446,7 @@ void delay500ns(uint16_t n) {
 	uint16_t start;
 	
 	start = TZ1.TCNT;
-	while (TZ1.TCNT - start < n) ;
+	while ((uint16_t) (TZ1.TCNT - start) < n) ;
 }
 
 int clockSetup() {
@@ -411,6 +526,7 @@ void lcdInit() {
 	delay500ns(90); // min 37us
 	lcdSend(0x01, 0);  // clear display
 	delay500ns(6000); // min 1.53ms
+	for (i = 0; i < 32; i++) lcdShadow[i >> 4][i & 15] = ' ';
 	
 	lcdSend(0x48, 0); // degree symbol
 	delay500ns(90); // min 37us
@@ -425,31 +541,44 @@ void lcdInit() {
 		lcdSend(arrowSymbol[i], 1);
 		delay500ns(90); // min 37us
 	}
+	lcdPos = 0xff; // the address counter is in CGRAM
 }
 
+// sends one cell that differs from lcdShadow per call, with an address command first
+// when it is not next to the last one; every LCD_RESYNC the whole screen is sent again
+// in case noise upset the controller
 void lcdProc() {
-	uint8_t row, col;
+	uint8_t i, row, col;
 	
-	if (TZ1.TCNT - tLcdSend < 90) return;
+	if ((uint16_t) (t4ms - tLcdSync) >= LCD_RESYNC) {
+		tLcdSync = t4ms;
+		for (i = 0; i < 32; i++) lcdShadow[i >> 4][i & 15] = 0; // no character is 0
+		lcdPos = 0xff;
+		lcdRefresh = 1;
+	}
+	if (!lcdRefresh || (uint16_t) (TZ1.TCNT - tLcdSend) < 90) return;
 	
-	row = (lcdPos >> 6) & 1;
-	if (lcdProcRun) {
-		col = lcdPos & 0x3f;
-		lcdSend(lcdLine[row][col], 1);
-		lcdPos++;
-		if (col == 15) lcdProcRun = 0;
-	} else {
-		row ^= 1;
-		if (lcdRefresh & (1 << row)) {
-			lcdRefresh &= ~(1 << row);
-			lcdPos = row << 6;
-			lcdProcRun = 1;
-			lcdSend(0x80 | lcdPos, 0);
-		}
+	for (i = 0; i < 32; i++) {
+		row = lcdScan >> 4;
+		col = lcdScan & 15;
+		if (lcdLine[row][col] != lcdShadow[row][col]) break;
+		lcdScan = (lcdScan + 1) & 31;
+	}
+	if (i == 32) {
+		lcdRefresh = 0;
+		return;
+	}
+	if (lcdPos != ((row << 6) | col)) {
+		lcdPos = (row << 6) | col;
+		lcdSend(0x80 | lcdPos, 0);
+		return;
 	}
-}		
+	lcdSend(lcdLine[row][col], 1);
+	lcdShadow[row][col] = lcdLine[row][col];
+	lcdPos++;
+}
 
-void lcdPrintln(uint8_t row, char data[]) {
+void lcdPrintln(uint8_t row, const char data[]) {
 	uint8_t i, j;
 
 	if (row > 1) return;
@@ -459,8 +588,8 @@ void lcdPrintln(uint8_t row, char data[]) {
 			lcdLine[row][i] = data[j++];
 		else
 			lcdLine[row][i] = 0x20;
+		if (lcdLine[row][i] != lcdShadow[row][i]) lcdRefresh = 1;
 	}
-	lcdRefresh |= 1 << row;
 }
 
 void lcdPrintf(uint8_t row, const char *format, ...) {
@@ -503,38 +632,121 @@ void serialPrintf(const char *format, ...) {
 /* ** EEPROM functions ************* */
 /* ********************************* */
 
+// V/f curve as a fraction of Rated voltage at a fraction of Rated frequency: linear, quadratic
+// for centrifugal loads or through five points, plus a boost that fades out at Rated frequency;
+// above Rated frequency the curve continues with the ratio it has there
+void vfCalc() {
+	uint8_t i, k;
+	float rated, u, v;
+
+	rated = 1048.576f * param[9];
+	for (i = 0; i < VF_NODES; i++) {
+		u = ((uint32_t) i << VF_SHIFT) / rated;
+		if (param[27] == 2) {
+			k = u < 1.0f ? u * 5.0f : 4;
+			v = k ? param[28 + k] : 0;
+			v = u < 1.0f ? v + (param[29 + k] - v) * (u * 5.0f - k) : param[33] * u;
+			v *= 0.01f;
+		} else if (param[27] == 1) {
+			v = u < 1.0f ? u * u : u;
+		} else {
+			v = u;
+		}
+		if (u < 1.0f) v += param[28] * 0.01f * (1.0f - u);
+		vfTable[i] = v * rated / 16.0f + 0.5f;
+	}
+}
+
 void setParam(uint8_t n) {
 	float r1;
 	
 	switch (n) {
-	case 0: pOn = 364.71875f + 10.30594f * param[n]; break;
-	case 1: pOff = 364.71875f + 10.30594f * param[n]; break;
+	case 0: pOn = (presFine(param[n] * 100) + 8) >> 4; break;
+	case 1: pOff = (presFine(param[n] * 100) + 8) >> 4; break;
 	case 2: vfdStopDelay = param[n] * 250; break;
 	case 3: autoRunStart = param[n];
-	case 4: maxFreq = 4.096f * param[n]; break;
-	case 5: baseFreq = 4.096f * param[n]; break;
-	case 6: minFreq = 4.096f * param[n]; break;
-	case 7: stopFreq = 4.096f * param[n]; break;
-	case 8: manualFreq = 4.096f * param[n]; break;
+	case 4: maxFreq = 1048.576f * param[n]; break;
+	case 5: baseFreq = 1048.576f * param[n]; break;
+	case 6: minFreq = 1048.576f * param[n]; break;
+	case 7: stopFreq = 1048.576f * param[n]; break;
+	case 8: manualFreq = 1048.576f * param[n]; break;
 	case 9:
-	case 10: freqToVolt = (float) param[n] / param[n - 1]; break;
-	case 11: maxCur = 7.7824f * param[n]; break;
-	case 12: minVolt = (float) param[n] * 2816 / 1395; break;
-	case 13: maxVolt = (float) param[n] * 2816 / 1395; break;
-	case 14: 
-		r1 = TEMP_R0 * expf(TEMP_B * ((1 / ((float) param[n] + TEMP_K) - 1 / TEMP_0)));
-		maxTemp = TEMP_RDIV / (r1 + TEMP_RDIV) * 1024;
+	case 10:
+		freqToVolt = (float) param[10] / param[9];
+		voltToPwm = freqToVolt * (252.0f * 62.5f / 4.0f * 256.0f * 2816.0f / 1395.0f * 1.414214f);
+		vfCalc();
+		// no break, the no-flow power is given at Rated frequency
+	case 36:
+		r1 = 1048.576f * param[9];
+		flowK = param[36] / POW_W / (r1 * r1 * r1);
+		dryK = 0;
+		// no break, the ramp times are given up to Rated frequency
+	case 42:
+	case 43:
+		if (param[42] && param[43]) { // 0 only while the EEPROM is repaired
+			accStep = 10737.42f * param[9] / param[42]; // 5Hz in 60s is 0.35 freq per tick
+			decStep = 10737.42f * param[9] / param[43];
+		}
+		// no break, the S-curve is a share of the ramp rates
+	case 44:
+		accJerk = param[44] ? accStep / (25 * param[44]) + 1 : 0;
+		decJerk = param[44] ? decStep / (25 * param[44]) + 1 : 0;
+		break;
+	case 45: pGate = param[n] * 2000UL; break; // timer Z1 at 2MHz
+	case 11:
+		maxCur = 7.7824f * param[n];
+		ocTrip = maxCur < 510 ? maxCur << 1 : 1020; // 13.1A, 8.0A Max current would be 1244
+		// no break, the current limit is a share of Max current
+	case 40: curLimit = (uint32_t) maxCur * param[40] / 100; break;
+	case 12:
+		minVolt = (float) param[n] * 2816 / 1395;
+		// no break, the ride-through level is given above Undervoltage
+	case 41: uvWarn = param[41] ? (float) (param[12] + param[41]) * 2816 / 1395 : 0; break;
+	case 13:
+		maxVolt = (float) param[n] * 2816 / 1395;
+		ovStall = maxVolt - OV_MARGIN;
 		break;
+	case 14: maxTemp = tempAdc(param[n] * 10); break;
 	case 15: noFlowTimeout = param[n] / 0.032768f;
 	case 16: rotDirParam = param[n]; break;
 	case 17: extSwConfig = param[n]; break;
 	case 18: ignFaults = param[n]; break;
 	case 19: ledIntensity = 0xff >> (param[n] - 1); break;
 	case 20: mbId = param[n]; break;
+	case 21: regMode = param[n]; break;
+	case 22: pSet = (presFine(param[n] * 100) + 8) >> 4; break;
+	case 23:
+	case 24:
+		regKp = 16.279f * param[23]; // 0.1Hz/bar, Q4 frequency per pAct or Q8 per pFine
+		regTi = param[24]; // 0.1s = REG_PERIOD
+		break;
+	case 25: pwmMode = param[n]; break;
+	case 26: pwmCarrier = param[n] >= 16 ? 0 : param[n] >= 8 ? 1 : 2; break;
+	case 27:
+	case 28:
+	case 29:
+	case 30:
+	case 31:
+	case 32:
+	case 33: vfCalc(); break;
+	case 34: fluxOn = param[n]; break;
+	case 35: // command, stored as 0
+		if (param[n]) calStep = 1;
+		param[n] = 0;
+		break;
+	case 37: flowGain = 60.0f * POW_W * param[n]; break; // 0.1 l/min = 6000 * W / mbar
+	case 38: flowThr = param[n]; break;
+	case 39: dryLevel = param[n]; break;
 	}
 }
 
-uint8_t spiCmd(uint32_t data, uint8_t out, uint8_t in) {
+// sequential read: after the READ command the EEPROM keeps shifting out the following bytes
+// for as long as CS stays on, so any number of bytes comes in with one command
+void eepRead(uint8_t *data, uint8_t addr, uint8_t size) {
+	uint16_t cmd;
+	uint8_t n;
+	
+	cmd = 0x400 | addr;
 	IO.PDR5.BIT.B7 = 1; // CS on
 	IO.PDR5.BIT.B5 = 1; // start bit
 	delay(2);
@@ -542,8 +754,8 @@ uint8_t spiCmd(uint32_t data, uint8_t out, uint8_t in) {
 	delay(4);
 	IO.PDR5.BIT.B6 = 0;
 	delay(4);
-	while (out--) {
-		IO.PDR5.BIT.B5 = (data >> out) & 1;
+	for (n = 11; n--; ) {
+		IO.PDR5.BIT.B5 = (cmd >> n) & 1;
 		delay(4);
 		IO.PDR5.BIT.B6 = 1;
 		delay(4);
@@ -552,77 +764,177 @@ uint8_t spiCmd(uint32_t data, uint8_t out, uint8_t in) {
 	IO.PDR5.BIT.B5 = 0;
 	delay(4);
 
-	while (in--) {
-		IO.PDR5.BIT.B6 = 1;
-		delay(3);
-		data <<= 1;
-		IO.PDR5.BIT.B6 = 0;
-		delay(2);
-		data |= IO.PDR5.BIT.B4;
-		delay(2);
+	while (size--) {
+		for (n = 0; n < 8; n++) {
+			IO.PDR5.BIT.B6 = 1;
+			delay(3);
+			*data <<= 1;
+			IO.PDR5.BIT.B6 = 0;
+			delay(2);
+			*data |= IO.PDR5.BIT.B4;
+			delay(2);
+		}
+		data++;
 	}
 	delay(2);
 	IO.PDR5.BIT.B7 = 0; // CS off
 	delay(2);
-	return (uint8_t) data;
 }
 
-void eepRead(uint8_t *data, uint8_t addr, uint8_t size) {
-	while (size--) {
-		*data = spiCmd(0x400 | addr, 11, 8);
-		addr++;
-		data++;
-	}
+// starts a command for eepProc(): CS on and the start bit, the bits are clocked later
+void eepCmd(uint32_t data, uint8_t out, uint8_t in) {
+	eepShift = data;
+	eepOut = out;
+	eepIn = in;
+	IO.PDR5.BIT.B7 = 1; // CS on
+	IO.PDR5.BIT.B5 = 1; // start bit
+	delay(2);
+	IO.PDR5.BIT.B6 = 1;
+	delay(4);
+	IO.PDR5.BIT.B6 = 0;
+	delay(4);
 }
 
-void eepWrite(uint8_t *data, uint8_t addr, uint8_t size) {
-	uint16_t tWr;
+// write queue: eepWrite() copies the bytes into the queue and returns, eepProc() clocks
+// EEP_BITS bits per main loop pass through write enable, write, ready poll, read back and
+// write disable once the queue is empty, so a parameter save never holds up the main loop.
+// A byte that does not read back is written again, after EEP_TRIES it counts in eepError
+void eepProc() {
+	uint8_t n;
 	
-	spiCmd(0x180, 11, 0); // write enable
-	while (size--) {
-		spiCmd(0x20000 | ((uint32_t) addr << 8) | *data, 19, 0);
-		addr++;
-		data++;
-		tWr = t4ms;
-		IO.PDR5.BIT.B7 = 1;
+	for (n = 0; n < EEP_BITS && eepOut; n++) {
+		eepOut--;
+		IO.PDR5.BIT.B5 = (eepShift >> eepOut) & 1;
+		delay(4);
+		IO.PDR5.BIT.B6 = 1;
+		delay(4);
+		IO.PDR5.BIT.B6 = 0;
+		if (!eepOut) {
+			IO.PDR5.BIT.B5 = 0;
+			delay(4);
+		}
+	}
+	for (; n < EEP_BITS && eepIn; n++) {
+		eepIn--;
+		IO.PDR5.BIT.B6 = 1;
+		delay(3);
+		eepShift <<= 1;
+		IO.PDR5.BIT.B6 = 0;
+		delay(2);
+		eepShift |= IO.PDR5.BIT.B4;
+		delay(2);
+	}
+	if (eepOut || eepIn) return;
+	if (eepState != EEP_IDLE && eepState != EEP_BUSY) {
+		delay(2);
+		IO.PDR5.BIT.B7 = 0; // CS off
 		delay(2);
-		while ((!IO.PDR5.BIT.B4) && (t4ms - tWr < 3));
+	}
+	
+	switch (eepState) {
+	case EEP_IDLE:
+		if (eepHead == eepTail) return;
+		eepCmd(0x180, 11, 0); // write enable
+		eepState = EEP_ENABLE;
+		break;
+	case EEP_ENABLE:
+		eepCmd(0x20000 | ((uint32_t) eepQAddr[eepTail] << 8) | eepQData[eepTail], 19, 0);
+		eepState = EEP_WRITE;
+		break;
+	case EEP_WRITE:
+		IO.PDR5.BIT.B7 = 1; // DO shows ready while CS is on
+		tEep = t4ms;
+		eepState = EEP_BUSY;
+		break;
+	case EEP_BUSY:
+		if (!IO.PDR5.BIT.B4 && (uint16_t) (t4ms - tEep) < EEP_BUSY_TIME) return;
 		IO.PDR5.BIT.B7 = 0;
 		delay(2);
+		eepCmd(0x400 | eepQAddr[eepTail], 11, 8); // read back
+		eepState = EEP_VERIFY;
+		break;
+	case EEP_VERIFY:
+		if ((uint8_t) eepShift != eepQData[eepTail] && ++eepTry < EEP_TRIES) {
+			eepState = EEP_ENABLE;
+			break;
+		}
+		if ((uint8_t) eepShift != eepQData[eepTail]) eepError++;
+		eepTry = 0;
+		eepTail = (eepTail + 1) & (EEP_QUEUE - 1);
+		eepPending--;
+		if (eepHead != eepTail) {
+			eepState = EEP_ENABLE;
+			break;
+		}
+		eepCmd(0x000, 11, 0); // write disable
+		eepState = EEP_DISABLE;
+		break;
+	case EEP_DISABLE:
+		eepState = EEP_IDLE;
+		break;
 	}
-	spiCmd(0x000, 11, 0); // write disable
 }
 
+void eepWrite(uint8_t *data, uint8_t addr, uint8_t size) {
+	while (size--) {
+		while (((eepHead + 1) & (EEP_QUEUE - 1)) == eepTail) { // only a repair of the whole EEPROM fills it
+			eepProc();
+			WDT.TCWD = 0;
+		}
+		eepQAddr[eepHead] = addr++;
+		eepQData[eepHead] = *data++;
+		eepHead = (eepHead + 1) & (EEP_QUEUE - 1);
+		eepPending++;
+	}
+}
+
+// CRC-16 of the parameter block in eepImage, with the Modbus polynomial
+uint16_t eepCrc() {
+	uint8_t i;
+	uint16_t c;
+	
+	c = 0xffff;
+	for (i = EEP_SIGN; i < EEP_CRC_ADDR; i++)
+		c = (c >> 8) ^ crcTable[(uint8_t) (c ^ ((uint8_t *) eepImage)[i])];
+	return c;
+}
+
+// queues param[n] and the new CRC of the parameter block
+void saveParam(uint8_t n) {
+	eepImage[paramDef[n].eepAddr >> 1] = param[n];
+	eepImage[EEP_CRC_ADDR >> 1] = eepCrc();
+	eepWrite((uint8_t *) &param[n], paramDef[n].eepAddr, 2);
+	eepWrite((uint8_t *) &eepImage[EEP_CRC_ADDR >> 1], EEP_CRC_ADDR, 2);
+}
+
+// the whole image is read with one sequential read; with the signature and the CRC intact the
+// parameters are taken as they are, with a bad CRC (an old image, a save cut off by a power
+// loss) each one is range checked and only those out of range are set to their default,
+// without the signature all of them are
 void loadEeprom() {
-	uint8_t i, byte;
-	int16_t value;
+	uint8_t i, repair;
 	
-	for (i = 0; i < 8; i++) {
-		eepRead(&byte, i, 1);
-		if (byte != eepSign[i]) goto repairEeprom;
-	}
+	eepRead((uint8_t *) eepImage, 0, EEP_SIZE);
+	for (i = 0; i < EEP_SIGN; i++)
+		if (((uint8_t *) eepImage)[i] != eepSign[i]) break;
+	repair = i < EEP_SIGN ? 2 : eepImage[EEP_CRC_ADDR >> 1] != eepCrc();
 	for (i = 0; i < N_PARAM; i++) {
-		eepRead((uint8_t *) &value, paramDef[i].eepAddr, 2);
-		if (value >= paramDef[i].min & value <= paramDef[i].max)
-			param[i] = value;
-		else
-			goto repairEeprom;
-		WDT.TCWD = 0;
+		param[i] = eepImage[paramDef[i].eepAddr >> 1];
+		if (repair == 2 || (repair && (param[i] < paramDef[i].min || param[i] > paramDef[i].max))) {
+			param[i] = paramDef[i].def;
+			eepImage[paramDef[i].eepAddr >> 1] = param[i];
+			eepWrite((uint8_t *) &param[i], paramDef[i].eepAddr, 2);
+		}
 	}
-	for (i = 0; i < N_PARAM; i++) {
-		setParam(i);
-		WDT.TCWD = 0;
+	if (repair) {
+		eepImage[EEP_CRC_ADDR >> 1] = eepCrc();
+		eepWrite((uint8_t *) &eepImage[EEP_CRC_ADDR >> 1], EEP_CRC_ADDR, 2);
+		if (repair == 2) eepWrite((uint8_t *) eepSign, 0, EEP_SIGN);
 	}
-	return;
-	
-repairEeprom:
 	for (i = 0; i < N_PARAM; i++) {
-		param[i] = paramDef[i].def;
-		eepWrite((uint8_t *) &param[i], paramDef[i].eepAddr, 2);
 		setParam(i);
 		WDT.TCWD = 0;
 	}
-	eepWrite((uint8_t *) eepSign, 0, 8);
 }
 
 /* ********************************* */
@@ -670,7 +982,7 @@ uint8_t readKey() {
 		lastKey = key;
 		return key;
 	} else {
-		if (t4ms - tKey > (keyFirst ? 200 : 15)) {
+		if ((uint16_t) (t4ms - tKey) > (keyFirst ? 200 : 15)) {
 			tKey = t4ms;
 			keyFirst = 0;
 			return key;
@@ -687,12 +999,20 @@ uint8_t readKey() {
 void startVfd() {
 	if (vfdRun) return;
 	rotDir = rotDirParam;
+	set_imask_ccr(1);
 	freq = 0;
+	freqFrac = 0;
+	fineStep = 0;
 	pwmRatio = 0;
-	TZ0.GRB = PWM_MAX / 2;
-	TZ0.GRC = PWM_MAX / 2;
-	TZ0.GRD = PWM_MAX / 2;
-	set_imask_ccr(1);
+	pwmShift = pwmCarrier; // outputs are off, the carrier can change now
+	pwmMax = PWM_MAX_16K << pwmShift;
+	TZ0.GRA = pwmMax;
+	pwmGr[0] = pwmMax / 2;
+	pwmGr[1] = pwmMax / 2;
+	pwmGr[2] = pwmMax / 2;
+	TZ0.GRB = pwmMax / 2;
+	TZ0.GRC = pwmMax / 2;
+	TZ0.GRD = pwmMax / 2;
 	if (!(fault || scFault)) {
 		TZ.TOCR.BYTE = 0;
 		TZ.TOER.BYTE = 0xf1; // enable outputs B0, C0, D0
@@ -708,22 +1028,93 @@ void stopVfd() {
 	TZ.TOCR.BYTE = 0;
 	TZ.TOER.BYTE = 0xff; // disable outputs B0, C0, D0
 	vfdRun = 0;
+	fluxScale = 256;
+	fluxFreq = 0;
+	fluxPhase = 0;
+}
+
+// fixed rate PI law, the integrator is clamped to minFreq..maxFreq (anti-windup);
+// without flow it aims slightly above OFF pressure so that the pump can stop
+int32_t regPi() {
+	int16_t err;
+	
+	err = ((flow ? pSet : pOff + REG_STOP_MARGIN) << 4) - pFine;
+	// Kp / Ti as a factor truncates to 0 for a low gain and a long Ti, so the step is divided
+	// and its remainder carried to the next period
+	regRem += (int32_t) regKp * err;
+	regInt += regRem / regTi;
+	regRem %= regTi;
+	if (freqLimited && regInt > ((int32_t) freq << 8)) regInt = (int32_t) freq << 8; // no windup at the current or bus voltage limit
+	if (regInt < ((int32_t) minFreq << 8)) regInt = (int32_t) minFreq << 8;
+	if (regInt > ((int32_t) maxFreq << 8)) regInt = (int32_t) maxFreq << 8;
+	return (regInt + (int32_t) regKp * err) >> 8;
+}
+
+// perturb and observe on the DC power averaged over the regulator period: INT_TimerB1 slows
+// the pump down whenever the bus is below mpptVolt, this moves mpptVolt one step per period
+// and turns back when the power fell; a PV string too weak for Min frequency stops the pump
+uint16_t regMppt() {
+	uint16_t cur, tick;
+	uint32_t pow;
+
+	set_imask_ccr(1);
+	cur = curTotal;
+	tick = t4ms;
+	set_imask_ccr(0);
+	pow = (uint32_t) voltage * (uint16_t) (cur - mpptCur) / (uint16_t) (tick - mpptTick);
+	mpptCur = cur;
+	mpptTick = tick;
+	if (voltage < mpptVolt && freq < minFreq) {
+		mpptStop = t4ms;
+		regOn = 0;
+		return 0;
+	}
+	if (voltage < mpptVolt + 2 * MPPT_STEP) { // limited by the PV string
+		if (pow < mpptPow) mpptDir = -mpptDir;
+		mpptVolt += mpptDir * MPPT_STEP;
+	}
+	mpptPow = pow;
+	if (mpptVolt < minVolt + MPPT_VOLT_MARGIN) mpptVolt = minVolt + MPPT_VOLT_MARGIN;
+	if (mpptVolt > maxVolt) mpptVolt = maxVolt;
+	if (pAct > pOff) {
+		if (mpptFreq > minFreq) mpptFreq -= 256;
+	} else if (mpptFreq < maxFreq) {
+		mpptFreq += 256;
+	}
+	return mpptFreq;
 }
 
 void regVfd() {
-	int16_t tmp;
+	int32_t tmp;
 	
 	tReg = t4ms;
 	if (fault || scFault) {
 		if (vfdRun) stopVfd();
 		return;
 	}
-	if ((pAct < pOn) || (regOn && (tReg - tOn < vfdStopDelay)) || flow) {
+	if (regMode == REG_MPPT && !regOn && (uint16_t) (tReg - mpptStop) < MPPT_HOLD) {
+		tmp = 0;
+	} else if ((pAct < pOn) || (regOn && ((uint16_t) (tReg - tOn) < vfdStopDelay)) || flow) {
 		if (!regOn || (pAct < pOff) || flow) {
 			tOn = t4ms;
+			if (!regOn) {
+				regInt = (int32_t) baseFreq << 8;
+				regRem = 0;
+				mpptFreq = maxFreq;
+				mpptVolt = voltage - (voltage >> 3) - (voltage >> 4); // PV strings have their MPP near 80% of Voc
+				mpptDir = -1;
+				mpptPow = 0;
+				mpptCur = curTotal - current; // first period is the last 4ms average
+				mpptTick = t4ms - 1;
+			}
 			regOn = 1;
 		}
-		tmp = ((pOff - pAct) >> 2) + baseFreq;
+		if (regMode == REG_MPPT)
+			tmp = regMppt();
+		else if (regMode)
+			tmp = regPi();
+		else
+			tmp = ((int32_t) (pOff - pAct) << 6) + baseFreq;
 	} else {
 		tmp = 0;
 		regOn = 0;
@@ -734,110 +1125,355 @@ void regVfd() {
 	reqFreq = tmp;
 }
 
+// DC bus feed-forward, called with each new voltage average: modulation depth
+// is scaled by the reciprocal of the bus voltage, clamped to the fault limits
 void voltCalc() {
-	uint16_t tmp;
-	float voltNow;
+	uint16_t volt;
+	uint32_t tmp;
 	
-	if (voltage < minVolt || voltage > maxVolt) return;
-	voltNow = (float) voltage * (1395.0f / 2816.0f / 1.414214f);
-	tmp = freqToVolt / voltNow * (252.0f * 62.5f / 4.0f);
-	if (tmp > 255) tmp = 255;
-	if (freqToPwm == 0)
-		freqToPwm = tmp;
-	else if (tmp > freqToPwm)
-		freqToPwm++;
-	else if (tmp < freqToPwm)
-		freqToPwm--;
-	tVoltCalc = t4ms;
+	volt = voltage;
+	if (volt < minVolt) volt = minVolt;
+	if (volt > maxVolt) volt = maxVolt;
+	if (!volt) return;
+	tmp = voltToPwm / volt;
+	freqToPwm = tmp > 0xffff ? 0xffff : tmp;
+}
+
+// modulation depth for freq at the present bus voltage and flux scale
+uint16_t ratioCalc() {
+	uint16_t ratio;
+
+	ratio = ((uint32_t) VF_LERP(freq) * freqToPwm >> 18) * fluxScale >> 8;
+	if (ratio > 251) ratio = 251;
+	return ratio << pwmShift;
+}
+
+// DC link current conversion in active vector curVec of this carrier period
+void curStart() {
+	adcConv = curVec;
+	curSeg = 2 * (pwmEdge[curVec] - pwmEdge[curVec - 1]) + curPend[curVec - 1];
+	curPend[curVec - 1] = 0;
+	curTaken = 1;
+	AD.ADCSR.BYTE = 0x40 | adcChan[1];
+	AD.ADCSR.BYTE = 0x60 | adcChan[1];
+}
+
+// 4ms work kept out of INT_TimerB1, where it would delay the compare match writes at 16kHz:
+// the sums get one sample per tick, also for ticks the main loop was late for, and pwmRatio
+// follows the new freq; a recharge step of INT_ADI meanwhile is left to the next IMFA
+void tickProc() {
+	uint16_t ratio;
+	uint8_t seq;
+
+	if (tSum == t4ms) return;
+	while (tSum != t4ms) {
+		tSum++;
+		curTotal += current;
+		powTotal += (uint32_t) voltage * current;
+	}
+	seq = ratioSeq;
+	ratio = ratioCalc();
+	set_imask_ccr(1);
+	if (seq == ratioSeq) pwmRatio = ratio;
+	set_imask_ccr(0);
+}
+
+// S-curve ramp step for a target dist away: the step grows by jerk per 4ms tick up to the ramp
+// rate and shrinks again once the distance left is about what it takes to bring it back down;
+// the step stays a multiple of jerk, so that distance is the sum of the steps on the way up
+uint32_t sCurve(uint32_t dist, uint32_t step, uint32_t jerk, uint8_t up) {
+	if (up != rampUp) { // turned around, start from standstill
+		rampUp = up;
+		rampStep = 0;
+	}
+	if (!rampStep) rampBrake = 0;
+	if (rampBrake + rampStep >= dist) {
+		if (rampStep > jerk) {
+			rampBrake -= rampStep;
+			rampStep -= jerk;
+		}
+	} else if (rampStep + jerk <= step) {
+		rampStep += jerk;
+		rampBrake += rampStep;
+	}
+	return rampStep ? rampStep : jerk;
+}
+
+// flux optimizer, perturb and observe on the DC power: once the frequency has settled, the
+// output voltage is probed one step away from the base scale and measured at the base before
+// and after, each one FLUX_PERIOD after the pressure loop has settled on it, so that a slow
+// power trend cancels out; the step is kept when the probe took less power, otherwise the search
+// turns around. A phase current peak rising at lower voltage means the slip grows faster
+// than the magnetizing current falls, which rejects the probe like a higher power does
+void fluxOpt() {
+	uint16_t tick, peak;
+	uint32_t energy, pow;
+
+	set_imask_ccr(1);
+	energy = powTotal;
+	tick = t4ms;
+	peak = curPeak;
+	curPeak = 0;
+	set_imask_ccr(0);
+	pow = (energy - fluxEnergy) / (uint16_t) (tick - fluxTick);
+	fluxEnergy = energy;
+	fluxTick = tick;
+	fluxMeas ^= 1;
+	if (fluxMeas) { // settled now, measure in the next period
+		fluxLast = freq;
+		return;
+	}
+	// |a - b| > band as (uint16_t) (a - b + band) > 2 * band, freq + band would wrap above 61.7Hz
+	if ((uint16_t) (freq - fluxLast + FLUX_SETTLE) > 2 * FLUX_SETTLE ||
+		(uint16_t) (freq - fluxFreq + FLUX_BAND) > 2 * FLUX_BAND) {
+		// pressure loop still moving or new operating point, back towards the V/f curve until it settles
+		if (fluxPhase == 1) fluxScale -= fluxDir * FLUX_STEP;
+		if (fluxScale < 256) fluxScale += FLUX_STEP;
+		if (fluxScale > 256) fluxScale = 256;
+		fluxFreq = freq;
+		fluxDir = -1;
+		fluxPhase = 0;
+		return;
+	}
+	switch (fluxPhase) {
+	case 2:
+		if (fluxProbe < ((fluxPow + pow) >> 1) && fluxProbePeak <= maxCur &&
+			(fluxDir > 0 || fluxProbePeak <= fluxPeak + (fluxPeak >> 4))) {
+			fluxScale += fluxDir * FLUX_STEP;
+			fluxPhase = 0;
+			break;
+		}
+		fluxDir = -fluxDir;
+		// no break, this period was a base measurement
+	case 0:
+		fluxPow = pow;
+		fluxPeak = peak;
+		if (fluxScale + fluxDir * FLUX_STEP > 256 || fluxScale + fluxDir * FLUX_STEP < FLUX_MIN)
+			fluxDir = -fluxDir;
+		fluxScale += fluxDir * FLUX_STEP;
+		fluxPhase = 1;
+		break;
+	case 1:
+		fluxProbe = pow;
+		fluxProbePeak = peak;
+		fluxScale -= fluxDir * FLUX_STEP;
+		fluxPhase = 2;
+		break;
+	}
+}
+
+// Base frequency calibration: without flow the pump pressure settles at its shut-off head,
+// which grows with the square of the frequency; the frequency is raised in CAL_STEP steps,
+// each step that lifted the pressure above the tank pressure is a point of h = a * f^2
+// (least squares), and Base and Min frequency are stored where h reaches OFF pressure
+// plus CAL_MARGIN and ON pressure; the DC power at the same points gives the No-flow power
+// for the flow estimate, P = k * f^3 near the operating frequencies; flow that never stops
+// or a falling pressure cancels the calibration; the current limit, the UV ride-through or the
+// MPPT regulator can hold freq below a step for good while no-flow detection is off, so the
+// whole calibration has CAL_TIMEOUT
+void calProc() {
+	uint8_t i;
+	uint32_t energy;
+	float a, f[2];
+
+	if (fault || scFault) {
+		calStep = 0;
+		calResult = 0;
+		reqFreq = 0;
+		return;
+	}
+	if (calStep == 1) {
+		calStep = 2;
+		calN = 0;
+		calWait = 0;
+		calFF = 0;
+		calFH = 0;
+		calF6 = 0;
+		calPF = 0;
+		calTank = pAct;
+		calPres = pAct;
+		tCalStart = z1highWord;
+		reqFreq = CAL_FREQ_START;
+		return;
+	}
+	if ((uint16_t) (z1highWord - tCalStart) > CAL_TIMEOUT) {
+		calStep = 0;
+		calResult = CAL_TIMED_OUT;
+		reqFreq = 0;
+		return;
+	}
+	if (calStep == 2) { // the dwell and the power average start at the step frequency
+		if (freq != reqFreq) return;
+		calStep = 3;
+		set_imask_ccr(1);
+		calEnergy = powTotal;
+		tCal = t4ms;
+		set_imask_ccr(0);
+		return;
+	}
+	if ((uint16_t) (t4ms - tCal) < CAL_DWELL) return;
+	if (freq != reqFreq) { // held below the step, the sums would wrap while it waits
+		calStep = 2;
+		return;
+	}
+	set_imask_ccr(1);
+	energy = powTotal;
+	a = (uint16_t) (t4ms - tCal);
+	tCal = t4ms;
+	set_imask_ccr(0);
+	a = (energy - calEnergy) / a; // DC power over this period
+	calEnergy = energy;
+	if (pAct + CAL_LIFT < calTank) calWait = CAL_WAIT; // water is being drawn
+	if (calWait >= CAL_WAIT || flow || pAct - calPres > CAL_SETTLE || calPres - pAct > CAL_SETTLE) {
+		calPres = pAct;
+		if (++calWait < CAL_WAIT) return;
+		calStep = 0;
+		calResult = 0;
+		reqFreq = 0;
+		return;
+	}
+	calWait = 0;
+	if (pAct > calTank + CAL_LIFT) {
+		f[0] = (float) freq * freq * freq;
+		calF6 += f[0] * f[0];
+		calPF += f[0] * a;
+		a = (float) freq * freq;
+		calFF += a * a;
+		calFH += a * pMbar;
+		calN++;
+	}
+	if (calN < CAL_POINTS && pAct < pOff + CAL_MARGIN && reqFreq <= maxFreq - CAL_STEP) {
+		reqFreq += CAL_STEP;
+		calStep = 2;
+		return;
+	}
+	calStep = 0;
+	calResult = 0;
+	reqFreq = 0;
+	if (calN < 2) return;
+	a = calFH / calFF;
+	f[0] = sqrtf(presLerp((pOff + CAL_MARGIN) << 4) / a) / 1048.576f + 0.99f;
+	f[1] = sqrtf(presLerp(pOn << 4) / a) / 1048.576f + 0.99f;
+	if (f[1] > f[0]) f[1] = f[0];
+	for (i = 0; i < 2; i++) {
+		if (f[i] < paramDef[5 + i].min) f[i] = paramDef[5 + i].min;
+		if (f[i] > paramDef[5 + i].max) f[i] = paramDef[5 + i].max;
+		param[5 + i] = f[i];
+		setParam(5 + i);
+		saveParam(5 + i);
+	}
+	a = 1048.576f * param[9];
+	a = calPF / calF6 * POW_W * a * a * a + 0.5f;
+	param[36] = a > paramDef[36].max ? paramDef[36].max : a;
+	setParam(36);
+	saveParam(36);
+	calResult = calN;
 }
 
 /* ********************************* */
 /* ** Signal input functions ******* */
 /* ********************************* */
 
-void adcProc() {
-	uint8_t adcsr, chan;
-	
-	adcsr = AD.ADCSR.BYTE;
-	if (adcsr & 0x80) {
-		chan = adcsr & 7;
-		switch (chan) {
-			case 3:
-				flow = !IO.PDRB.BIT.B2;
-				if (flow || !vfdRun) tNoFlow = z1highWord;
-
-				adcVal[0] += AD.ADDRD >> 6;
-				adcCnt[0]++;
-				if (adcCnt[0] == 0x40) {
-					temp = adcVal[0] >> 6;
-					adcCnt[0] = 0;
-					adcVal[0] = 0;
-					chan = 4;
-				}
-				break;
-			case 4:
-				adcVal[1] += AD.ADDRA >> 6;
-				adcCnt[1]++;
-				if (adcCnt[1] == 0x40) {
-					current = adcVal[1] >> 6;
-					adcCnt[1] = 0;
-					adcVal[1] = 0;
-					chan = 6;
-				}
-				break;
-			case 6:
-				adcVal[2] += AD.ADDRC >> 6;
-				adcCnt[2]++;
-				if (adcCnt[2] == 0x40) {
-					voltage = adcVal[2] >> 6;
-					adcCnt[2] = 0;
-					adcVal[2] = 0;
-					chan = 3;
-				}
-				break;
-			default:
-				chan = 3;
-		}
-		AD.ADCSR.BYTE = chan;
-		AD.ADCSR.BYTE = chan | 0x20;
-	} else if (!(adcsr & 0x20)) {
-		AD.ADCSR.BYTE = 0x03;
-		AD.ADCSR.BYTE = 0x23;
+// dry running: a pump without water loses its hydraulic load and takes a fraction of the
+// power it needs even without flow; the lowest DC power per freq^3 of the running pump is
+// learned while flow is seen, starting from the No-flow power or the first period with flow,
+// quickly downwards and slowly upwards, and DRY_TIME periods below Dry run level % of it
+// set FAULT_DRY
+void dryCheck(float k) {
+	if (!dryLevel) return;
+	if (!dryK) {
+		if (param[36]) dryK = flowK;
+		else if (flow) dryK = k;
+		else return; // a pump that starts dry must not become the reference
+	}
+	if (k * 100 < dryK * dryLevel) {
+		dryCnt++;
+		return;
 	}
+	dryCnt = 0;
+	if (flow) dryK += (k - dryK) * (k < dryK ? 0.125f : 0.004f);
+}
+
+// pump flow from the hydraulic power: the DC power above the no-flow power at this frequency
+// (affinity law, P0 = k * f^3) times the wire-to-water Pump efficiency, over the head;
+// a period with a larger frequency change or below Min frequency keeps the last estimate,
+// its power was not for one frequency or mostly losses
+void flowEstimate() {
+	uint16_t tick;
+	uint32_t energy;
+	float q;
+
+	set_imask_ccr(1);
+	energy = powTotal;
+	tick = t4ms;
+	set_imask_ccr(0);
+	q = (energy - flowEnergy) / (uint16_t) (tick - tFlowEst);
+	flowEnergy = energy;
+	tFlowEst = tick;
+	if (!vfdRun) {
+		flowEst = 0;
+		flowFreq = 0;
+		dryCnt = 0;
+		return;
+	}
+	if ((uint16_t) (freq - flowFreq + FLOW_BAND) > 2 * FLOW_BAND || freq < minFreq ||
+		(uint16_t) (tick - tUvWarn) < UV_HOLD) {
+		flowFreq = freq;
+		return;
+	}
+	flowFreq = freq;
+	dryCheck(q / ((float) freq * freq * freq));
+	if (!param[36]) return;
+	q = (q - flowK * freq * freq * freq) * flowGain / (pMbar > FLOW_MIN_HEAD ? pMbar : FLOW_MIN_HEAD);
+	flowEst = q < 0 ? 0 : q > 9999 ? 9999 : q;
+}
+
+// with a Flow threshold the estimate replaces the flow switch
+void flowProc() {
+	if ((uint16_t) (t4ms - tFlowEst) >= FLOW_PERIOD) flowEstimate();
+	if (flowThr && param[36])
+		flow = flowEst >= flowThr;
+	else
+		flow = !IO.PDRB.BIT.B2;
+	if (flow || !vfdRun || calStep) tNoFlow = z1highWord;
 }
 
 uint8_t extSw() {
 	switch (extSwConfig) {
-	case 0: return 1;
 	case 1: return IO.PDR2.BIT.B3;
 	case 2: return !IO.PDR2.BIT.B3;
+	default: return 1;
 	}
 }
 
+// reciprocal counter: the sensor periods are summed until they span Pressure gate and the mean
+// period is the time between the first and the last edge over the number of periods, so the
+// timestamp jitter of the edges in between cancels out; a longer gate gives a quieter pAct with
+// a longer delay. Edges that the main loop did not get to are counted by INT_IRQ0, a period
+// outside the sensor range is dropped
 uint8_t newPressure() {
 	uint32_t tmpDiff, tmpNow;
+	uint8_t edges;
 	
+	set_imask_ccr(1);
 	if (pOvf && !(pLowWord & 0x8000)) pHighWord++;
 	tmpNow = pLowWord + ((uint32_t) pHighWord << 16);
+	edges = pEdges;
+	pEdges = 0;
+	pNew = 0;
+	set_imask_ccr(0);
 	tmpDiff = tmpNow - pTckLast;
 	pTckLast = tmpNow;
-	pNew = 0;
-	if ((tmpDiff < 23500) || (tmpDiff > 110000)) return 0;
-	pRaw[pIndex] = tmpDiff >> 6;
-	pIndex++;
-	if (pIndex > 2) pIndex = 0;
-	if (((pRaw[0] >= pRaw[1]) && (pRaw[0] <= pRaw[2])) ||
-		((pRaw[0] <= pRaw[1]) && (pRaw[0] >= pRaw[2]))) {
-		pAct = pRaw[0];
-	} else {
-		if (((pRaw[1] >= pRaw[0]) && (pRaw[1] <= pRaw[2])) ||
-			((pRaw[1] <= pRaw[0]) && (pRaw[1] >= pRaw[2]))) {
-			pAct = pRaw[1];
-		} else {
-			pAct = pRaw[2];
-		}
-	}
+	if (!edges || (tmpDiff < 23500UL * edges) || (tmpDiff > 110000UL * edges)) return 0;
 	tPres = t4ms;
+	pSum += tmpDiff;
+	pCnt += edges;
+	if (pSum < pGate) return 0;
+	pFine = (pSum / pCnt + 2) >> 2;
+	pAct = (pFine + 8) >> 4;
+	pMbar = presLerp(pFine);
+	pSum = 0;
+	pCnt = 0;
 	return 1;
 }
 
@@ -845,40 +1481,64 @@ uint8_t newPressure() {
 /* ** User interface functions ***** */
 /* ********************************* */
 
+// fast trips from INT_ADI have already disabled the outputs, stopVfd() lets the drive start
+// again; called with Ignore faults on as well, a trip from before would hold the outputs off
+uint16_t takeTrips() {
+	uint16_t trip;
+
+	if (!(scFault & (FAULT_OC | FAULT_OV))) return 0;
+	set_imask_ccr(1);
+	trip = scFault & (FAULT_OC | FAULT_OV);
+	scFault &= ~trip;
+	set_imask_ccr(0);
+	stopVfd();
+	return trip;
+}
+
 void checkFaults() {
+	uint16_t trip;
+
+	trip = takeTrips();
+	fault |= trip;
+	if (trip & FAULT_OV) tOv = t4ms;
 	if (!autoRun && !manualRun) {
-		fault &= ~(FAULT_OC | FAULT_NO_FLOW);
+		fault &= ~(FAULT_OC | FAULT_NO_FLOW | FAULT_DRY);
 	}
 
-	if (t4ms - tPres > 50) {
+	if ((uint16_t) (t4ms - tPres) > 50) {
 		fault |= FAULT_PRESSURE;
 		stopVfd();
 		tPresFault = t4ms;
-	} else if ((fault & FAULT_PRESSURE) && (t4ms - tPresFault > 1000)) {
+	} else if ((fault & FAULT_PRESSURE) && ((uint16_t) (t4ms - tPresFault) > 1000)) {
 		fault &= ~FAULT_PRESSURE;
 	}
-	if (voltage < minVolt) {
+	if (voltage >= minVolt) {
+		tUvTrip = t4ms;
+	}
+	if (voltage < minVolt && (!uvWarn || !vfdRun || (uint16_t) (t4ms - tUvTrip) > UV_TRIP_TIME)) {
 		fault |= FAULT_UV;
 		stopVfd();
 		tUv = t4ms;
-	} else if ((fault & FAULT_UV) && (t4ms - tUv > 1000)) {
+	} else if ((fault & FAULT_UV) && ((uint16_t) (t4ms - tUv) > 1000)) {
 		fault &= ~FAULT_UV;
 	}
 	if (voltage > maxVolt) {
 		fault |= FAULT_OV;
 		stopVfd();
 		tOv = t4ms;
-	} else if ((fault & FAULT_OV) && (t4ms - tOv > 1000)) {
+	} else if ((fault & FAULT_OV) && ((uint16_t) (t4ms - tOv) > 1000)) {
 		fault &= ~FAULT_OV;
 	}
 	if (temp > maxTemp) {
 		fault |= FAULT_TEMP;
 		stopVfd();
 		tTemp = t4ms;
-	} else if ((fault & FAULT_TEMP) && (t4ms - tTemp > 1000)) {
+	} else if ((fault & FAULT_TEMP) && ((uint16_t) (t4ms - tTemp) > 1000)) {
 		fault &= ~FAULT_TEMP;
 	}
-	if (current > maxCur) {
+	if (current <= maxCur) {
+		tOc = t4ms;
+	} else if (!curLimit || (uint16_t) (t4ms - tOc) > CUR_TRIP_TIME) {
 		fault |= FAULT_OC;
 		stopVfd();
 	}
@@ -886,49 +1546,67 @@ void checkFaults() {
 		fault |= FAULT_XTAL;
 		stopVfd();
 	}
-	if (z1highWord - tNoFlow > noFlowTimeout) {
+	if ((uint16_t) (z1highWord - tNoFlow) > noFlowTimeout) {
 		fault |= FAULT_NO_FLOW;
 		stopVfd();
 	}
+	if (dryCnt >= DRY_TIME) {
+		fault |= FAULT_DRY;
+		stopVfd();
+		dryCnt = 0;
+	}
 }
 
+// the display values are updated every cycle for Modbus, only the statusLine rows the
+// page shows are formatted
 void dispProc() {
 	uint16_t pageVal;
+	int16_t tmp;
 	
 	IO.PDR8.BIT.B6 = 1; // duration measurement
 	switch (dispStep++) {
 	case 0:
 		IO.PDR8.BIT.B5 = 1; // duration measurement
-		dispFreq = (float) freq * (62.5f / 256.0f) + 0.5;
-		writeNum(&statusLine[0][9], dispFreq, 2, 0);
+		dispPage = page;
+		if (page == 0) dispLines = 0x03;
+		else if (page == 1) dispLines = 0x05;
+		else if (page > PAGE_LAST_FAULT) dispLines = 0x08;
+		else dispLines = 0;
+		dispFreq = ((uint32_t) freq * 125 + 65536) >> 17; // 62.5Hz / 65536, rounded
+		if (dispLines & 0x01) writeNum(&statusLine[0][9], dispFreq, 2, 0);
 		break;
 	case 1:
-		dispVolt = (float) voltage * (1395.0f / 2816.0f);
-		writeNum(&statusLine[1][1], dispVolt, 3, 0);
+		dispVolt = (uint32_t) voltage * 32465 >> 16; // 1395 / 2816
+		if (dispLines & 0x02) writeNum(&statusLine[1][1], dispVolt, 3, 0);
 		break;
 	case 2:
-		dispCur = (float) current * (1250.0f / 9728.0f);
-		writeNum(&statusLine[1][6], dispCur, 1, 1);
+		dispCur = (uint32_t) current * 8421 >> 16; // 1250 / 9728
+		if (dispLines & 0x02) writeNum(&statusLine[1][6], dispCur, 1, 1);
 		break;
 	case 3:
+		dispPres = pMbar > 0 ? (pMbar + 50) / 100 : 0;
+		if (!(dispLines & 0x01)) break;
 		if (fault & FAULT_PRESSURE) {
 			statusLine[0][0] = ' ';
 			statusLine[0][1] = '-';
 			statusLine[0][2] = ' ';
 		} else {
-			dispPres = (float) (pAct - 364) * 0.09703136f;
 			writeNum(&statusLine[0][0], dispPres, 1, 1);
 		}
 		statusLine[0][7] = flow ? 0x02 : 0x20;
 		break;
 	case 4:
-		tempR = (float) (1024 - temp) / temp * TEMP_RDIV;
-		dispTemp = TEMP_0 * TEMP_B / (TEMP_0 * logf(tempR/TEMP_R0) + TEMP_B) - TEMP_K;
-		writeNum(&statusLine[1][11], dispTemp, 3, 0);
-		writeNum(&statusLine[2][11], dispTemp, 3, 0);
+		tmp = tempLerp(temp);
+		dispTemp = tmp > 0 ? (tmp + 5) / 10 : 0;
+		if (dispLines & 0x02) writeNum(&statusLine[1][11], dispTemp, 3, 0);
+		if (dispLines & 0x04) writeNum(&statusLine[2][11], dispTemp, 3, 0);
 		break;
 	case 5:
-		if (fault | scFault) {
+		if (!(dispLines & 0x01)) break;
+		if (fault & FAULT_DRY) { // does not fit the two hex digits
+			statusLine[0][14] = 'D';
+			statusLine[0][15] = 'R';
+		} else if (fault | scFault) {
 			statusLine[0][14] = ((fault | scFault) >> 4) & 0xf;
 			statusLine[0][14] += statusLine[0][14] < 10 ? '0' : ('A' - 10);
 			statusLine[0][15] = (fault | scFault) & 0xf;
@@ -939,8 +1617,8 @@ void dispProc() {
 		}
 		break;
 	case 6:
-		dispPow = (float) voltage * (float) current * (1395.0f / 2816.0f * 1250.0f / 9728.0f / 10.0f);
-		writeNum(&statusLine[2][1], dispPow, 4, 0);
+		dispPow = ((uint32_t) voltage * current >> 4) * 26699 >> 18; // 1395 / 2816 * 125 / 9728
+		if (dispLines & 0x04) writeNum(&statusLine[2][1], dispPow, 4, 0);
 
 /*		if ((pageDef[page].type == PAGE_FAULT) &&
 			!(((fault | scFault) >> (page - PAGE_FIRST_FAULT)) & 1)) {
@@ -948,11 +1626,12 @@ void dispProc() {
 				if (((fault | scFault) >> (page - PAGE_FIRST_FAULT)) & 1) break;
 			if (page > PAGE_LAST_FAULT) page = 0;
 		}*/
-		if (pageDef[page].type == PAGE_INT) {
-			writeNum(&statusLine[3][3], *pageDef[page].ptr, 5, 0);
+		if (!(dispLines & 0x08)) break;
+		if (pageDef[dispPage].type == PAGE_INT) {
+			writeNum(&statusLine[3][3], *pageDef[dispPage].ptr, 5, 0);
 			statusLine[3][8] = ' ';
-		} else if (pageDef[page].type == PAGE_HEX8) {
-			pageVal = *((uint8_t *) pageDef[page].ptr);
+		} else if (pageDef[dispPage].type == PAGE_HEX8) {
+			pageVal = *((uint8_t *) pageDef[dispPage].ptr);
 			statusLine[3][3] = '0';
 			statusLine[3][4] = 'x';
 			statusLine[3][5] = (pageVal >> 4) & 0xf;
@@ -961,8 +1640,8 @@ void dispProc() {
 			statusLine[3][6] += statusLine[3][6] < 10 ? '0' : ('A' - 10);
 			statusLine[3][7] = ' ';
 			statusLine[3][8] = ' ';
-		} else if (pageDef[page].type == PAGE_HEX16) {
-			pageVal = *pageDef[page].ptr;
+		} else if (pageDef[dispPage].type == PAGE_HEX16) {
+			pageVal = *pageDef[dispPage].ptr;
 			statusLine[3][3] = '0';
 			statusLine[3][4] = 'x';
 			statusLine[3][5] = (pageVal >> 12) & 0xf;
@@ -977,25 +1656,25 @@ void dispProc() {
 		break;
 	case 7:
 		if (!menu) {
-			if (page < PAGE_FIRST_FAULT) {
+			if (dispPage < PAGE_FIRST_FAULT) {
 				lcdPrintln(0, statusLine[0]);
-			} else if (page <= PAGE_LAST_FAULT) {
-				if ((pageDef[page].type == PAGE_FAULT) &&
-					!(((fault | scFault) >> (page - PAGE_FIRST_FAULT)) & 1)) {
+			} else if (dispPage <= PAGE_LAST_FAULT) {
+				if ((pageDef[dispPage].type == PAGE_FAULT) &&
+					!(((fault | scFault) >> (dispPage - PAGE_FIRST_FAULT)) & 1)) {
 					lcdPrintln(0, "FAULT (interm.):");
 				} else {
 					lcdPrintln(0, "FAULT:");
 				}
 			} else {
-				lcdPrintln(0, pageDef[page].name);
+				lcdPrintln(0, pageDef[dispPage].name);
 			}
 		}
 		break;
 	default:
 		if (!menu) {
-			if (page == 0) lcdPrintln(1, statusLine[1]);
-			else if (page == 1) lcdPrintln(1, statusLine[2]);
-			else if (page <= PAGE_LAST_FAULT) lcdPrintln(1, pageDef[page].name);
+			if (dispPage == 0) lcdPrintln(1, statusLine[1]);
+			else if (dispPage == 1) lcdPrintln(1, statusLine[2]);
+			else if (dispPage <= PAGE_LAST_FAULT) lcdPrintln(1, pageDef[dispPage].name);
 			else lcdPrintln(1, statusLine[3]);
 		}
 		dispStep = 0;
@@ -1080,7 +1759,7 @@ void menuProc() {
 		case 2:
 			param[menuItem] = itemValue;
 			setParam(menuItem);
-			eepWrite((uint8_t *) &param[menuItem], paramDef[menuItem].eepAddr, 2);
+			saveParam(menuItem);
 			menu--;
 			break;
 		}
@@ -1154,6 +1833,8 @@ int16_t mbGetReg(uint16_t reg) {
 	case 16: return dispTemp;
 	case 17: return fault | scFault;
 	case 18: return vfdRun;
+	case 19: return fluxScale;
+	case 20: return flowEst;
 	default: return 0;
 	}
 }
@@ -1163,7 +1844,7 @@ void mbProc() {
 	uint8_t byte;
 	
 	tz1now = TZ1.TCNT;
-	if ((tz1now - tModbus > 7292) && !mbResp) {
+	if (((uint16_t) (tz1now - tModbus) > 7292) && !mbResp) {
 		mbReqI = 0;
 		mbIgnore = 0;
 		crc = 0xffff;
@@ -1201,7 +1882,7 @@ void mbProc() {
 		SCI3.RDR;
 		switch (mbRespI) {
 		case 0: 
-			if (tz1now - tModbus > 7292) {
+			if ((uint16_t) (tz1now - tModbus) > 7292) {
 				calcCrc(mbId);
 				SCI3.TDR = mbId;
 				mbRespI++;
@@ -1247,7 +1928,7 @@ void mbProc() {
 			}
 			break;
 		default:
-			if (tz1now - tModbus < 7292) {
+			if ((uint16_t) (tz1now - tModbus) < 7292) {
 				SCI3.RDR;
 			} else {
 				mbResp = 0;
@@ -1268,7 +1949,7 @@ void main(void)
 	WDT.TCWD = 0; // watchdog reset
 	
 	MSTCR1.BYTE = 0x43; // module standby: RTC, Timer V, I2C
-	MSTCR2.BYTE = 0x91; // module standby: PWM, Timer B1, SCI3_2
+	MSTCR2.BYTE = 0x81; // module standby: PWM, SCI3_2
 
 	IO.PDR6.BIT.B1 = 0; // FTIOB0 = 0
 	IO.PDR6.BIT.B2 = 0; // FTIOC0 = 0
@@ -1295,10 +1976,16 @@ void main(void)
 	TZ0.TCR.BYTE = 0x20; // clear TCNT on GRA compare match
 	TZ1.TCR.BYTE = 0x03; // 16MHz / 8
 	TZ0.TCNT = 0;
-	TZ0.GRA = PWM_MAX;
+	pwmShift = 1;
+	pwmMax = PWM_MAX_16K << pwmShift;
+	TZ0.GRA = pwmMax;
 	TZ0.TIER.BYTE = 0x0f; // enable TZ0.GRA match interrupt
 	TZ1.TIER.BYTE = 0x10; // enable TZ1 overflow interrupt
 	TZ.TSTR.BYTE = 0x03; // timer Z0, Z1 start
+	TB1.TMB1.BYTE = 0xfb; // auto-reload, 16MHz / 256
+	TB1.TCB1.TLB1 = 6; // 250 counts = 4ms system tick
+	IENR2.BIT.IENTB1 = 1; // enable timer B1 overflow interrupt
+	AD.ADCSR.BYTE = 0x40; // A/D end interrupt enable, conversions are started from INT_TimerZ0
 	
 	lcdInit();
 
@@ -1310,53 +1997,60 @@ void main(void)
 	tDisp = t4ms;
 	loadEeprom();
 
-	while (t4ms - tDisp < 250) {
+	while ((uint16_t) (t4ms - tDisp) < 250) {
 		lcdProc();
+		eepProc();
 		WDT.TCWD = 0;
 	}
 	IO.PDR1.BIT.B1 = 1; // switch on relay
 	lcdPrintln(0, " Jakub Strnad");
 	lcdPrintln(1, " v0.9 02/2025");
 	tDisp = t4ms;
-	while (t4ms - tDisp < 250) {
+	while ((uint16_t) (t4ms - tDisp) < 250) {
 		newPressure();
-		adcProc();
+		tickProc();
+		flowProc();
 		lcdProc();
+		eepProc();
 		WDT.TCWD = 0;
 	}
-	
-	voltCalc();
 
 	autoRun = autoRunStart;
 	
 	while (1) {
 		isNewPres = pNew ? newPressure() : 0;
-		adcProc();
+		tickProc();
+		flowProc();
 
 		if (ignFaults) {
+			takeTrips();
 			fault = 0;
 		} else {
 			checkFaults();
 		}
 
-		if (t4ms - tVoltCalc > 250) voltCalc();
 
-		if (manualRun) {
+		if (calStep && (manualRun || (autoRun && extSw()))) {
+			calProc();
+		} else if (manualRun) {
 			reqFreq = manualFreq;
 		} else if (autoRun && extSw()) {
-			if (isNewPres) regVfd();
+			if (regMode ? (uint16_t) (t4ms - tReg) >= REG_PERIOD : isNewPres) regVfd();
 		} else {
+			if (calStep) calStep = calResult = 0; // no run mode cancels the calibration
 			reqFreq = 0;
 		}
 		if (fault || scFault) reqFreq = 0;
 		if (!vfdRun && (reqFreq > stopFreq)) startVfd();
 		else if (vfdRun && (reqFreq <= stopFreq) && (freq <= stopFreq)) stopVfd();
+		if (fluxOn && vfdRun && (uint16_t) (t4ms - fluxTick) >= FLUX_PERIOD) fluxOpt();
 
 		setLeds();
-		if (t4ms - tDisp > 4) dispProc();
+		if ((uint16_t) (t4ms - tDisp) > 4) dispProc();
 		if ((tLed & 1) && (key = readKey())) menuProc();
 		lcdProc();
 		mbProc();
+		eepProc();
 
 		WDT.TCWD = 0;
 	}
@@ -1395,6 +2089,7 @@ __interrupt(vect=14) void INT_IRQ0(void) { //irq0(); }
 	pHighWord = z1highWord;
 	pOvf = TZ1.TSR.BIT.OVF; // if OVF flag is set, we may need to add 1 to pHighWord
 	pNew = 1;
+	if (pEdges < 255) pEdges++;
 	IRR1.BIT.IRRI0 = 0;
 }
 
@@ -1425,59 +2120,302 @@ __interrupt(vect=23) void INT_SCI3(void) {/* sleep(); */}
 //  vector 24 IIC2
 __interrupt(vect=24) void INT_IIC2(void) {/* sleep(); */}
 //  vector 25 ADI
-__interrupt(vect=25) void INT_ADI(void) {/* sleep(); */}
+// 16-bit results are published in one write, readers need no interrupt masking;
+// single samples above the limits disable the running drive right here like INT_IRQ1,
+// checkFaults() moves the trip from scFault to fault
+__interrupt(vect=25) void INT_ADI(void) {
+	uint8_t i;
+	uint16_t val;
+
+	i = adcScan[adcSlot];
+	AD.ADCSR.BYTE; // ADF is cleared by reading it as 1 and writing 0
+	AD.ADCSR.BYTE = 0x40;
+	if (adcConv) {
+		val = AD.ADDRA >> 6; // AN4
+		// instantaneous phase current, twice the DC link average limit
+		if (val > ocTrip && vfdRun && !ignFaults) {
+			TZ.TOER.BYTE = 0xff; // disable outputs B0, C0, D0
+			TZ.TOCR.BYTE = 0;
+			scFault |= FAULT_OC;
+		}
+		curAct[adcConv - 1] = val;
+		if (val > curPeak) curPeak = val;
+		curSum += (uint32_t) curSeg * val;
+		if (adcConv == 1)
+			AD.ADCSR.BYTE = 0x60 | adcChan[adcScan[adcSlot]];
+		adcConv = 0;
+		return;
+	}
+	val = (&AD.ADDRA)[adcChan[i] & 3] >> 6;
+	adcSlot = (adcSlot + 1) & (ADC_SLOTS - 1);
+	if (i == 2 && val > maxVolt && vfdRun && !ignFaults) {
+		TZ.TOER.BYTE = 0xff;
+		TZ.TOCR.BYTE = 0;
+		scFault |= FAULT_OV;
+	}
+
+	// returning mains recharge the bus within a few carrier periods, a sample 1/8 above the
+	// average is followed at once, otherwise the output voltage overshoots until the next average;
+	// the next IMFA applies it to pwmRatio, here it would delay the compare match writes
+	if (i == 2 && val > voltage + (voltage >> 3)) {
+		adcVal[i] = 0;
+		adcCnt[i] = 0;
+		voltage = val;
+		voltCalc();
+		ratioNew = 1;
+		ratioSeq++;
+	}
+	adcVal[i] += val;
+	adcCnt[i]++;
+	if (adcCnt[i] >> adcDepth[i]) {
+		val = adcVal[i] >> adcDepth[i];
+		adcVal[i] = 0;
+		adcCnt[i] = 0;
+		switch (i) {
+		case 0: temp = val; break;
+		case 2:
+			voltage = val;
+			voltCalc();
+			break;
+		}
+	}
+}
 
 //  vector 26 Timer Z0
 __interrupt(vect=26) void INT_TimerZ0(void) { //irqZ0(); }
+	uint16_t tmp, lo, hi, mid;
+	uint8_t edge;
+
 //	IO.PDR8.BIT.B7 = 1; // duration measurement
 
 	if (TZ0.TSR.BIT.IMFA) {
 		TZ0.TSR.BIT.IMFA = 0;
-		z0cnt++;
-		if ((z0cnt & 0x1f) == 0) {
-			t4ms++;
-			if (freq < reqFreq)	freq++;
-			else if ((freq > reqFreq) && (freq != 0)) freq--;
+
+		// DC link current, 4ms average at any carrier: each active vector contributes its sample
+		// weighted with twice its length, the one sampled in this period from INT_ADI; the other
+		// one (or one that could not be sampled) gets half of it here from its last sample and the
+		// other half from its next one, a sample one period old alone reads low by the phase lag
+		tmp = curN & 1;
+		if (!curTaken) {
+			curSum += (uint32_t) (pwmEdge[tmp + 1] - pwmEdge[tmp] + curPend[tmp]) * curAct[tmp];
+			curPend[tmp] = pwmEdge[tmp + 1] - pwmEdge[tmp];
+		}
+		tmp ^= 1;
+		curSum += (uint32_t) (pwmEdge[tmp + 1] - pwmEdge[tmp]) * curAct[tmp];
+		curPend[tmp] += pwmEdge[tmp + 1] - pwmEdge[tmp];
+		curTaken = 0;
+		if (++curN == (64 >> pwmShift)) {
+			current = curSum / ((uint32_t) (64 >> pwmShift) * (pwmMax + 1) * 2);
+			curSum = 0;
+			curN = 0;
 		}
+		// pwmGr computed in the last period takes effect now, the active vectors
+		// lie between the lowest, middle and highest compare value
+		lo = pwmGr[0];
+		hi = pwmGr[0];
+		if (pwmGr[1] < lo) lo = pwmGr[1];
+		if (pwmGr[1] > hi) hi = pwmGr[1];
+		if (pwmGr[2] < lo) lo = pwmGr[2];
+		if (pwmGr[2] > hi) hi = pwmGr[2];
+		pwmEdge[0] = lo;
+		pwmEdge[1] = pwmGr[0] + pwmGr[1] + pwmGr[2] - lo - hi;
+		pwmEdge[2] = hi;
+		// temperature and voltage every other period after the current sample,
+		// or right here in the zero vector when there is no current to sample
+		if (!(curN & 1) && pwmEdge[1] - pwmEdge[0] < CUR_MIN_SEG && !(AD.ADCSR.BYTE & 0xa0)) {
+			AD.ADCSR.BYTE = 0x40 | adcChan[adcScan[adcSlot]];
+			AD.ADCSR.BYTE = 0x60 | adcChan[adcScan[adcSlot]];
+		}
+
 		if (rotDir)
-			fineIndex -= freq;
+			fineIndex -= fineStep;
 		else
-			fineIndex += freq;
-		svpwmIndex = (fineIndex >> 7) & 0xff;
+			fineIndex += fineStep;
+		svpwmIndex = (uint16_t) (fineIndex >> 16) >> SVPWM_FRAC;
+		svpwmNext = (svpwmIndex + 1) & ((1 << SVPWM_BITS) - 1);
+		svpwmFrac = (uint16_t) (fineIndex >> 16) & ((1 << SVPWM_FRAC) - 1);
+		if (ratioNew) {
+			ratioNew = 0;
+			pwmRatio = ratioCalc();
+		}
 	
-		pwmRatio = freq * freqToPwm >> 6;
-		if (pwmRatio > 251) pwmRatio = 251;
+		// compare values are written during this period and take effect in the next one,
+		// computing them here keeps the compare match branches below as short as possible
+		pwmGr[0] = ((int32_t) SVPWM_LERP(svpwmU) * pwmRatio >> (6 + SVPWM_SHIFT + SVPWM_INTERP)) + (pwmMax >> 1);
+		pwmGr[1] = ((int32_t) SVPWM_LERP(svpwmV) * pwmRatio >> (6 + SVPWM_SHIFT + SVPWM_INTERP)) + (pwmMax >> 1);
+		pwmGr[2] = ((int32_t) SVPWM_LERP(svpwmW) * pwmRatio >> (6 + SVPWM_SHIFT + SVPWM_INTERP)) + (pwmMax >> 1);
+
+		// discontinuous PWM: all phases are shifted by the same offset so that the highest one
+		// never matches and stays on the rail for the whole period, each phase rests for 120 degrees
+		// and the line-to-line voltage is unchanged
+		if (pwmMode) {
+			tmp = pwmGr[0];
+			if (pwmGr[1] > tmp) tmp = pwmGr[1];
+			if (pwmGr[2] > tmp) tmp = pwmGr[2];
+			tmp = pwmMax + 1 - tmp;
+			pwmGr[0] += tmp;
+			pwmGr[1] += tmp;
+			pwmGr[2] += tmp;
+		}
+		// a phase resting on the rail has no compare match to update it, so it is written here
+		if (TZ0.GRD > pwmMax) TZ0.GRD = pwmGr[0];
+		if (TZ0.GRC > pwmMax) TZ0.GRC = pwmGr[1];
+		if (TZ0.GRB > pwmMax) TZ0.GRB = pwmGr[2];
 	}
 	
 	// we have to write each register right after its compare match because this MCU has no preload buffer
 	// and writing them at wrong time will cause the pulse to not turn off in that cycle
+	edge = 0;
 	if (TZ0.TSR.BIT.IMFD) {
 		TZ0.TSR.BIT.IMFD = 0;
-		TZ0.GRD = ((int16_t) svpwmU[svpwmIndex] * pwmRatio >> 5) + PWM_MAX / 2;
+		TZ0.GRD = pwmGr[0];
+		edge = 1;
 	}
 	if (TZ0.TSR.BIT.IMFC) {
 		TZ0.TSR.BIT.IMFC = 0;
-		TZ0.GRC = ((int16_t) svpwmV[svpwmIndex] * pwmRatio >> 5) + PWM_MAX / 2;
+		TZ0.GRC = pwmGr[1];
+		edge = 1;
 	}
 	if (TZ0.TSR.BIT.IMFB) {
 		TZ0.TSR.BIT.IMFB = 0;
-		TZ0.GRB = ((int16_t) svpwmW[svpwmIndex] * pwmRatio >> 5) + PWM_MAX / 2;
+		TZ0.GRB = pwmGr[2];
+		edge = 1;
+	}
+
+	// the DC link current in an active vector is one phase current, the two vectors are sampled
+	// in alternate periods so that the conversions never collide; a vector that ends too soon
+	// after the interrupt latency keeps the sample of an earlier period. The current ramps
+	// through the vector, so a sample right after its leading edge reads low when the vector
+	// is long and one delayed by the latency reads high when it is short: the conversion starts
+	// in the middle, or CUR_MIN_SEG before the end, from a timer Z1 compare match at 16MHz / 8
+	if (edge && !(AD.ADCSR.BYTE & 0xa0)) {
+		edge = curN & 1;
+		tmp = TZ0.TCNT;
+		if (tmp >= pwmEdge[edge] && tmp + CUR_MIN_SEG <= pwmEdge[edge + 1]) {
+			curVec = edge + 1;
+			mid = (pwmEdge[edge] + pwmEdge[edge + 1]) >> 1;
+			if (mid > pwmEdge[edge + 1] - CUR_MIN_SEG) mid = pwmEdge[edge + 1] - CUR_MIN_SEG;
+			if (mid >= tmp + CUR_START_LAT + 16) {
+				TZ1.GRA = TZ1.TCNT + ((mid - CUR_START_LAT - tmp) >> 3);
+				TZ1.TSR.BIT.IMFA = 0;
+				TZ1.TIER.BYTE = 0x11; // enable TZ1 overflow and GRA match interrupt
+			} else
+				curStart();
+		}
 	}
 	
 //	IO.PDR8.BIT.B7 = 0;
 }
 
 //  vector 27 Timer Z1
+// the current sample INT_TimerZ0 scheduled, unless a longer handler delayed it out of its vector
 __interrupt(vect=27) void INT_TimerZ1(void) {
-	z1highWord++;
-	TZ1.TSR.BYTE;
-	TZ1.TSR.BIT.OVF = 0;
+	uint16_t tmp;
+
+	if (TZ1.TSR.BIT.IMFA) {
+		TZ1.TSR.BIT.IMFA = 0;
+		TZ1.TIER.BYTE = 0x10;
+		tmp = TZ0.TCNT;
+		if (curVec == (curN & 1) + 1 && !curTaken && !(AD.ADCSR.BYTE & 0xa0) &&
+				tmp >= pwmEdge[curVec - 1] && tmp + CUR_MIN_SEG <= pwmEdge[curVec])
+			curStart();
+	}
+	if (TZ1.TSR.BIT.OVF) {
+		z1highWord++;
+		TZ1.TSR.BIT.OVF = 0;
+	}
 }
 
 //  vector 28 Reserved
 
 //  vector 29 Timer B1
-__interrupt(vect=29) void INT_TimerB1(void) {/* sleep(); */}
+// 4ms system tick, independent of the PWM carrier
+__interrupt(vect=29) void INT_TimerB1(void) {
+	uint16_t tmp, stall;
+	uint32_t dist, step;
+	uint8_t uvHold;
+
+	IRR2.BIT.IRRTB1 = 0;
+	t4ms++;
+	// stall prevention: the ramp stops rising near Current limit and slows the pump down above it,
+	// so a load spike becomes a speed dip; checkFaults trips only if the current still exceeds Max current.
+	// Below uvWarn the frequency falls by up to UV_STEP, faster the deeper the bus sags, and below the
+	// rotor speed the pump feeds its kinetic energy back into the bus; for UV_HOLD after that the ramp
+	// rises at a quarter of the rate. The MPPT regulator holds the bus on its own
+	if (regMode != REG_MPPT && voltage < uvWarn) tUvWarn = t4ms;
+	else if ((uint16_t) (t4ms - tUvWarn) > UV_HOLD) tUvWarn = t4ms - UV_HOLD; // no wraparound
+	uvHold = (uint16_t) (t4ms - tUvWarn) < UV_HOLD;
+	freqLimited = (curLimit && current > curLimit - (curLimit >> 4)) || (uvHold && voltage < uvWarn + (uvWarn >> 3));
+	// solar MPPT holds the bus at mpptVolt with a quarter of the ramp rate, which keeps the
+	// motor slip from oscillating; an overloaded PV string collapses within milliseconds,
+	// so well below mpptVolt it slows down at the full rate
+	if (freq <= reqFreq) decFreq = 0;
+	if (regMode != REG_MPPT && voltage < uvWarn) {
+		tmp = 256 + ((uvWarn - voltage) << (8 - UV_SHIFT));
+		if (tmp > UV_STEP) tmp = UV_STEP;
+		if (freq > stopFreq + tmp) freq -= tmp;
+		else if (freq > stopFreq) freq = stopFreq;
+		rampStep = 0;
+	} else if (curLimit && current > curLimit) {
+		if (freq > stopFreq + 256) freq -= 256;
+		else if (freq > stopFreq) freq = stopFreq;
+		rampStep = 0;
+	} else if (regMode == REG_MPPT && freq <= reqFreq) {
+		if (voltage < mpptVolt - 2 * MPPT_STEP || (voltage < mpptVolt && !(t4ms & 3))) {
+			if (freq > stopFreq + 256) freq -= 256;
+			else if (freq > stopFreq) freq = stopFreq;
+		} else if (voltage > mpptVolt + MPPT_STEP && freq < reqFreq && !freqLimited && !(t4ms & 3)) {
+			freq = reqFreq - freq > 256 ? freq + 256 : reqFreq;
+		}
+	} else if (freq < reqFreq) {
+		if (freqLimited) {
+			rampStep = 0;
+		} else if (!uvHold || !(t4ms & 3)) {
+			dist = ((uint32_t) (reqFreq - freq) << 8) - freqFrac;
+			step = accJerk ? sCurve(dist, accStep, accJerk, 1) : accStep;
+			if (dist > step) {
+				step += freqFrac;
+				freq += step >> 8;
+				freqFrac = step;
+			} else {
+				freq = reqFreq;
+				freqFrac = 0;
+			}
+		}
+	} else if (freq > reqFreq) {
+		// a pump decelerating faster than it coasts feeds its energy into the bus: as the bus rises
+		// towards OV_RISE above its level at the start of the ramp (at most ovStall) the ramp eases
+		// off and stops, above that it turns back up, at most to the frequency it started from;
+		// a PV string rises on its own towards its open-circuit voltage as the load drops, so with
+		// the MPPT regulator only ovStall applies
+		if (!decFreq) {
+			decFreq = freq;
+			decVolt = voltage;
+		}
+		stall = decVolt + OV_RISE < ovStall && regMode != REG_MPPT ? decVolt + OV_RISE : ovStall;
+		dist = ((uint32_t) (freq - reqFreq) << 8) + freqFrac;
+		step = decJerk ? sCurve(dist, decStep, decJerk, 0) : decStep;
+		if (voltage >= stall) {
+			tmp = 256 + ((voltage - stall) << (8 - OV_SHIFT));
+			freq = (uint32_t) freq + tmp < decFreq ? freq + tmp : decFreq;
+			rampStep = 0;
+		} else {
+			if (voltage + (1 << OV_BAND_SHIFT) > stall)
+				step = step * (stall - voltage) >> OV_BAND_SHIFT;
+			if (dist > step) {
+				dist -= step;
+				freq = reqFreq + (dist >> 8);
+				freqFrac = dist;
+			} else {
+				freq = reqFreq;
+				freqFrac = 0;
+			}
+		}
+	} else {
+		rampStep = 0;
+	}
+	fineStep = (uint32_t) freq << (8 + pwmShift); // 62.5Hz per 65536 at any carrier
+}
 //  vector 30 Reserved
 
 //  vector 31 Reserved